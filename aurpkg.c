@@ -7,24 +7,101 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <limits.h>
 #include <stdint.h>
+#include <stdarg.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/utsname.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <termios.h>
 #include <err.h>
 #include <errno.h>
 #include <getopt.h>
-#include <curl/curl.h>
+#include <glob.h>
+#include <elf.h>
+#include <pthread.h>
 #include <parson.h>
+#include <zlib.h>
+
+#include "libaurpkg.h"
 
 /* General macros. */
 #define AUR_BASE_URL            "https://aur.archlinux.org"
-#define AUR_SEARCH_URL          "https://aur.archlinux.org/rpc/v5/search"
-#define AUR_INFO_URL            "https://aur.archlinux.org/rpc/v5/info"
-#define AUR_CGIT_PATH           "cgit/aur.git/snapshot"
+#define AUR_SEARCH_PATH         "/rpc/v5/search"
+#define AUR_INFO_PATH           "/rpc/v5/info"
+#define AUR_CGIT_PATH           "/cgit/aur.git/snapshot"
+#define AUR_SRCINFO_PATH        "/cgit/aur.git/plain/.SRCINFO?h="
 #define DEFAULT_TAR_PATH        "/usr/bin/tar"
 #define ALT_TAR_PATH            "/bin/tar"
 #define DEFAULT_MAKEPKG_PATH    "/usr/bin/makepkg"
 #define DEFAULT_OS_RELEASE      "/etc/os-release"
+#define DEFAULT_MAKEPKG_CONF    "/etc/makepkg.conf"
+#define DEFAULT_PACMAN_PATH     "/usr/bin/pacman"
+#define DEFAULT_SUDO_PATH       "/usr/bin/sudo"
+#define DEFAULT_GPG_PATH        "/usr/bin/gpg"
+#define DEFAULT_BSDTAR_PATH     "/usr/bin/bsdtar"
+#define DEFAULT_SHA256SUM_PATH  "/usr/bin/sha256sum"
+#define DEFAULT_PAGER_PATH      "/usr/bin/less"
+#define DEFAULT_KEYSERVER       "https://keyserver.ubuntu.com"
+#define DEFAULT_CCACHE_PATH     "/usr/bin/ccache"
+#define DEFAULT_SCCACHE_PATH    "/usr/bin/sccache"
+#define CCACHE_OVERLAY_NAME     "makepkg-ccache.conf"
+
+/* Prefetch limits, 2 MiB/s and 64 MiB in total. */
+#define PREFETCH_MAX_RATE       (2 * 1024 * 1024)
+#define PREFETCH_MAX_DISK       (64 * 1024 * 1024)
+
+/* Sync database index macros. */
+#define DEFAULT_SYNC_DIR        "/var/lib/pacman/sync"
+#define DEFAULT_LOCAL_DIR       "/var/lib/pacman/local"
+#define DEFAULT_LD_SO_CONF      "/etc/ld.so.conf"
+#define SYNC_INDEX_NAME         "syncdb.idx"
+#define SYNC_INDEX_MAGIC        "AURSIDX2"
+
+/* Provider index macros. */
+#define PROVIDER_INDEX_NAME     "providers"
+#define PROVIDER_BUCKETS        ((size_t)16384)
+#define PROVIDER_TTL            86400
+#define PROVIDER_MAX_INFO       100
+
+/* Render macros. Dates this close to the ends of the last day are
+   converted again, DST may have moved its midnight. No zone moves
+   its clock by more than 2 hours for DST. */
+#define RENDER_DST_WINDOW       (3 * 3600)
+
+/* Interactive search macros. */
+#define LIVE_LRU_SIZE           16
+#define LIVE_DEBOUNCE_MS        250
+#define LIVE_MIN_TERM           2
+
+/* State of the endpoints, in the cache directory. */
+#define MIRROR_STATE_NAME       "mirrors"
+
+/* Request budget macros. The AUR allows 4000 RPC requests
+   per IP address in a day, which is shared among every
+   aurpkg process running on this machine. */
+#define AUR_RATE_LIMIT          4000
+#define AUR_RATE_WINDOW         86400
+#define AUR_RATE_RESERVE        200
+#define AUR_COALESCE_SECS       60
+#define AUR_CACHE_MAX_AGE       (7 * 86400)
+#define CACHE_DIR_NAME          "aurpkg"
+#define LEDGER_FILE_NAME        "ledger"
+#define SRCINFO_CACHE_NAME      "srcinfo"
 
 /* Color macros. */
 #define COLOR_BLUE     "\x1b[1;34m"
@@ -37,6 +114,14 @@
 #define COLOR_END      "\x1b[0m"
 #define UNDERLINE      "\x1b[4m"
 
+/* The benchmarks have their own main(), so the functions which
+   only the options call are unused there. */
+#ifdef AURPKG_BENCH
+#define MAIN_ONLY      __attribute__((unused))
+#else
+#define MAIN_ONLY
+#endif
+
 /* Array size. */
 #define ARRAY_SIZE(x)           (sizeof(x) / sizeof(x[0]))
 
@@ -47,22 +132,31 @@ struct curl_memory {
 	size_t bt;
 };
 
-/* Main AUR package structure.
-   Holds various types of information. */
-struct aur_pkg {
-	const char *name;
-        const char *description;
-        uint32_t id;
-        time_t first_sub;
-	time_t last_mod;
-	const char *maintainer;
-	uint32_t numvotes;
-	time_t outdated;
-        double popularity;
-	const char *url;
-	const char *url_path;
-	const char *url_base;
-	const char *version;
+/* Offset of a missing (null) string in the result store. */
+#define STORE_NONE              UINT32_MAX
+
+/* Compact store for the search results. Every field is a column
+   (array) indexed by the result number, numbers are kept as is and
+   strings are offsets into a single arena. Maintainers and package
+   bases repeat a lot, so they're interned. Once it's filled, the
+   JSON tree and the response can be freed. */
+struct aur_store {
+	size_t count;
+	uint32_t *numvotes;
+	double *popularity;
+	time_t *outdated;
+	time_t *last_modified;
+	uint32_t *name;
+	uint32_t *description;
+	uint32_t *version;
+	uint32_t *maintainer;
+	uint32_t *url_path;
+	uint32_t *url_base;
+	char *arena;
+	size_t arena_sz;
+	size_t arena_cap;
+	uint32_t *itab;
+	size_t itab_cap;
 };
 
 /* AUR package information structure. */
@@ -91,22 +185,33 @@ struct arg_opts {
 	int is_get;
 	int is_colors;
 	int is_help;
+	int is_ccache;
+	int is_provides;
+	int is_install_once;
+	int is_check_rebuilds;
+	int is_interactive;
+	int is_plan;
+	size_t prefetch;
+	const char *search;
+	const char *build_root;
+	const char *keyserver;
+	const char *local_repo;
 };
 
-/* Format the URL for AUR_SEARCH_URL. */
+/* Format the path for AUR_SEARCH_PATH. */
 static char *format_simple_url(const char *name)
 {
 	char *p;
 	size_t sz;
 
-	/* Length of the AUR_SEARCH_URL, 1 for the "/",
+	/* Length of the AUR_SEARCH_PATH, 1 for the "/",
 	   and last one for the null terminator. */
-	sz = strlen(name) + (size_t)41;
+	sz = strlen(name) + sizeof(AUR_SEARCH_PATH"/");
 	p = calloc(sz, sizeof(char));
 	if (p == NULL)
 		err(EXIT_FAILURE, "calloc()");
 
-	snprintf(p, sz, "%s/%s", AUR_SEARCH_URL, name);
+	snprintf(p, sz, "%s/%s", AUR_SEARCH_PATH, name);
 	return (p);
 }
 
@@ -147,6 +252,89 @@ static size_t curl_write_cb(void *data, size_t sz, size_t nmb, void *usrp)
 	return (rsz);
 }
 
+/* Append a formatted string to the growable buffer, "bt" is
+   the number of bytes allocated for it. */
+static void mem_append(struct curl_memory *cm, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+	char *rp;
+
+	for (;;) {
+		if (cm->bt > cm->nsz) {
+			va_start(ap, fmt);
+			n = vsnprintf(cm->resp + cm->nsz, cm->bt - cm->nsz, fmt, ap);
+			va_end(ap);
+			if (n < 0)
+				err(EXIT_FAILURE, "vsnprintf()");
+
+			if (cm->nsz + (size_t)n < cm->bt)
+				break;
+		} else {
+			n = 256;
+		}
+
+		cm->bt = cm->bt * 2 + (size_t)n + 1;
+		rp = realloc(cm->resp, cm->bt);
+		if (rp == NULL)
+			err(EXIT_FAILURE, "realloc()");
+		cm->resp = rp;
+	}
+
+	cm->nsz += (size_t)n;
+}
+
+/* Append len bytes of str to the growable buffer, as they are. */
+static void mem_put(struct curl_memory *cm, const char *str, size_t len)
+{
+	char *rp;
+
+	if (cm->nsz + len + 1 > cm->bt) {
+		cm->bt = cm->bt * 2 + len + 1;
+		rp = realloc(cm->resp, cm->bt);
+		if (rp == NULL)
+			err(EXIT_FAILURE, "realloc()");
+		cm->resp = rp;
+	}
+
+	memcpy(cm->resp + cm->nsz, str, len);
+	cm->nsz += len;
+	cm->resp[cm->nsz] = '\0';
+}
+
+static void mem_puts(struct curl_memory *cm, const char *str)
+{
+	mem_put(cm, str, strlen(str));
+}
+
+/* Append an unsigned number. */
+static void mem_put_uint(struct curl_memory *cm, uint64_t v)
+{
+	char buf[24];
+	size_t i;
+
+	i = sizeof(buf);
+	do {
+		buf[--i] = (char)('0' + v % 10);
+		v /= 10;
+	} while (v > 0);
+	mem_put(cm, buf + i, sizeof(buf) - i);
+}
+
+/* Append a number with two decimals, as "%.2lf" formats it. */
+static void mem_put_fixed2(struct curl_memory *cm, double v)
+{
+	char buf[64];
+	int n;
+
+	n = snprintf(buf, sizeof(buf), "%.2lf", v);
+	if (n < 0 || (size_t)n >= sizeof(buf)) {
+		mem_append(cm, "%.2lf", v);
+		return;
+	}
+	mem_put(cm, buf, (size_t)n);
+}
+
 /* Decompress .tar.gz archives, by executing the general "tar" command.
    Note that it doesn't check whether you've or not the gunzip command. */
 static void targz_decompress_archive(char *pkg)
@@ -280,672 +468,6184 @@ static void print_warn_not_arch_gnu(int enable_colors)
 	}
 }
 
-/* Run makepkg. */
-static void makepkg_and_install(const char *dir)
+/* Get (and create, if needed) the cache directory. It's either
+   $XDG_CACHE_HOME/aurpkg or $HOME/.cache/aurpkg. Returns NULL if
+   none of them can be used, in that case, we'll skip caching. */
+static char *cache_dir_path(void)
 {
-	pid_t pid;
-	int ret;
+	const char *xdg, *home;
+	char *p;
+	size_t sz;
 
-	/* Check whether you're using Arch GNU/Linux or not. */
-	if (likely_running_arch_gnu() == 0)
-		errx(EXIT_FAILURE,
-		     "You are not running Arch GNU/Linux. "
-		     "So I cannot run 'makepkg' here.");
+	xdg = getenv("XDG_CACHE_HOME");
+	home = getenv("HOME");
+	if ((xdg == NULL || *xdg == '\0') && (home == NULL || *home == '\0'))
+		return (NULL);
 
-	ret = access(DEFAULT_MAKEPKG_PATH, F_OK);
-	if (ret == -1) {
-		if (errno == ENOENT)
-			errx(EXIT_FAILURE,
-			     "access(): 'makepkg' is not installed.");
-		else
-			err(EXIT_FAILURE, "access()");
-	}
+	sz = (xdg != NULL && *xdg != '\0' ? strlen(xdg) : strlen(home) +
+	      sizeof("/.cache")) + sizeof("/"CACHE_DIR_NAME);
+	p = calloc(sz, sizeof(char));
+	if (p == NULL)
+		err(EXIT_FAILURE, "calloc()");
 
-	pid = fork();
-	if (pid == (pid_t)-1)
-	        err(EXIT_FAILURE, "fork()");
+	if (xdg != NULL && *xdg != '\0')
+		snprintf(p, sz, "%s", xdg);
+	else
+		snprintf(p, sz, "%s/.cache", home);
 
-	if (pid == (pid_t)0) {
-	        if (chdir(dir) == -1)
-			err(EXIT_FAILURE, "chdir()");
+	if (mkdir(p, 0755) == -1 && errno != EEXIST) {
+		free(p);
+		return (NULL);
+	}
 
-		ret = execl(DEFAULT_MAKEPKG_PATH, "makepkg", "-si",
-			    (char *)NULL);
-		if (ret == -1)
-			_exit(127);
+	/* Append our own directory. */
+	strcat(p, "/"CACHE_DIR_NAME);
+	if (mkdir(p, 0755) == -1 && errno != EEXIST) {
+		free(p);
+		return (NULL);
 	}
 
-	/* Wait till it's done. */
-        while (waitpid(pid, NULL, 0) < 0)
-		;
+	return (p);
 }
 
-/* Do curl request to search for a specific package. */
-static char *search_for_pkg(const char *pkg)
+/* FNV-1a hash, used to name the cache files after URLs. */
+static uint64_t fnv1a_hash(const char *str)
 {
-	CURL *curl;
-	CURLcode ret;
-	char *fmt;
-	struct curl_memory cm;
-
-	/* Zero-fill the curl_memory structure. */
-	memset(&cm, '\0', sizeof(struct curl_memory));
-        curl = curl_easy_init();
-	if (curl == NULL)
-		err(EXIT_FAILURE, "curl_easy_init()");
+	uint64_t h;
 
-	fmt = format_simple_url(pkg);
-	curl_easy_setopt(curl, CURLOPT_URL, fmt);
-	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, (long)1);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&cm);
-
-	ret = curl_easy_perform(curl);
-	curl_easy_cleanup(curl);
-	curl_global_cleanup();
-	free(fmt);
-
-	if (ret != CURLE_OK)
-	        err(EXIT_FAILURE, "curl_easy_perform()");
+	h = (uint64_t)0xcbf29ce484222325;
+	while (*str != '\0') {
+		h ^= (uint8_t)*str++;
+		h *= (uint64_t)0x100000001b3;
+	}
 
-	/* Return the response buffer. */
-	return (cm.resp);
+	return (h);
 }
 
-/* Using curl, download a file from the URL. */
-static void download_from_url(const char *name, const char *url,
-			      long show_progress)
+/* Read the whole file in a null terminated buffer.
+   Returns NULL, if the file cannot be read. */
+static char *read_whole_file(const char *file)
 {
 	FILE *fp;
-	CURL *curl;
-	CURLcode ret;
+	long fsz;
+	char *p;
 
-	fp = fopen(name, "wb");
+	fp = fopen(file, "rb");
 	if (fp == NULL)
-		err(EXIT_FAILURE, "fopen()");
+		return (NULL);
 
-	curl = curl_easy_init();
-	if (curl == NULL)
-		err(EXIT_FAILURE, "curl_easy_init()");
+	fseek(fp, (long)0, SEEK_END);
+	fsz = ftell(fp);
+	fseek(fp, (long)0, SEEK_SET);
+	if (fsz < 0) {
+		fclose(fp);
+		return (NULL);
+	}
 
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, show_progress);
-	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, (long)1);
-	curl_easy_setopt(curl, CURLOPT_MAXREDIRS, (long)50);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
+	p = calloc((size_t)fsz + 1, sizeof(char));
+	if (p == NULL)
+		err(EXIT_FAILURE, "calloc()");
 
-	ret = curl_easy_perform(curl);
-	curl_easy_cleanup(curl);
-	curl_global_cleanup();
-	fclose(fp);
+	if (fread(p, (size_t)1, (size_t)fsz, fp) != (size_t)fsz) {
+		fclose(fp);
+		free(p);
+		return (NULL);
+	}
 
-	if (ret != CURLE_OK)
-        	err(EXIT_FAILURE, "curl_easy_perform()");
+	fclose(fp);
+	return (p);
 }
 
-/* Quicksort comparision function. */
-static int sort_compare(const void *a, const void *b)
+/* Write the buffer to a temporary file and then rename it, so
+   a process reading the cache never sees a partial response. */
+static void write_whole_file(const char *file, const char *buf)
 {
-	const JSON_Object *sa, *sb;
-        uint64_t vsa, vsb;
+	FILE *fp;
+	char *tmp;
+	size_t sz;
 
-	sa = *(const JSON_Object **)a;
-	sb = *(const JSON_Object **)b;
+	sz = strlen(file) + sizeof(".tmp");
+	tmp = calloc(sz, sizeof(char));
+	if (tmp == NULL)
+		err(EXIT_FAILURE, "calloc()");
 
-	/* Number of votes. */
-	vsa = (uint64_t)json_object_get_number(sa, "NumVotes");
-	vsb = (uint64_t)json_object_get_number(sb, "NumVotes");
+	snprintf(tmp, sz, "%s.tmp", file);
+	fp = fopen(tmp, "wb");
+	if (fp == NULL) {
+		warn("fopen()");
+		free(tmp);
+		return;
+	}
 
-	/* TODO: See Ant's answer. */
-	return ((vsa > vsb) - (vsa < vsb));
+	fwrite(buf, (size_t)1, strlen(buf), fp);
+	if (fclose(fp) == 0 && rename(tmp, file) == -1)
+		warn("rename()");
+	free(tmp);
 }
 
-/* Pretty print the time. */
-static char *pretty_time(time_t time)
-{
-        struct tm t, *lt;
-	char *tp;
-
-	/* Get the localtime of that timestamp. */
-	lt = localtime_r(&time, &t);
-	if (lt == NULL)
-		err(EXIT_FAILURE, "localtime_r()");
+/* Library context of the CLI, created on the first request. */
+static struct aurpkg_ctx *aur;
 
-	tp = calloc((size_t)16, sizeof(char));
-	if (tp == NULL)
-		err(EXIT_FAILURE, "calloc()");
+/* Set in the prefetch child. It shares the parent's atexit()
+   handlers, which must only run in the parent, if the child exits
+   on an error. */
+static int prefetch_child;
 
-	strftime(tp, (size_t)16, "%Y-%m-%d", &t);
-	return (tp);
+/* Free the library context, which saves the endpoint state. */
+static void free_aur_context(void)
+{
+	/* Its connections and state are the parent's. */
+	if (prefetch_child)
+		return;
+	aurpkg_free(aur);
+	aur = NULL;
 }
 
-/* Safely use strtoul (unsigned long). */
-static uintptr_t safe_atoul(const char *str)
+/* Create a library context, with the endpoints from AURPKG_MIRRORS
+   (separated by spaces or commas), and their state in the cache
+   directory. Without any, the official endpoint is used. */
+static struct aurpkg_ctx *new_aur_context(void)
 {
-	uintptr_t ret;
+	struct aurpkg_ctx *ctx;
+	const char *env;
+	char *dir, *list, *p, *sv;
+	size_t sz;
 
-	ret = strtoul(str, (char **)NULL, 10);
-	return (ret);
+	ctx = aurpkg_new();
+	if (ctx == NULL)
+		errx(EXIT_FAILURE, "aurpkg_new(): cannot create a context.");
+
+	env = getenv("AURPKG_MIRRORS");
+	if (env != NULL) {
+		list = strdup(env);
+		if (list == NULL)
+			err(EXIT_FAILURE, "strdup()");
+
+		for (p = strtok_r(list, " ,\t\n", &sv); p != NULL;
+		     p = strtok_r(NULL, " ,\t\n", &sv))
+			if (aurpkg_add_endpoint(ctx, p) != AURPKG_OK)
+				warnx("warning: endpoint '%s' is ignored.", p);
+		free(list);
+	}
+
+	dir = cache_dir_path();
+	if (dir != NULL) {
+		sz = strlen(dir) + sizeof("/"MIRROR_STATE_NAME);
+		p = calloc(sz, sizeof(char));
+		if (p == NULL)
+			err(EXIT_FAILURE, "calloc()");
+		snprintf(p, sz, "%s/"MIRROR_STATE_NAME, dir);
+		aurpkg_set_state_file(ctx, p);
+		free(p);
+		free(dir);
+	}
+
+	return (ctx);
 }
 
-/* Pretty print all search results and add them to the aur_pkg structure. */
-static void print_search_results(const char *json, int enable_colors)
+/* Get the library context. */
+static struct aurpkg_ctx *aur_context(void)
 {
-	size_t i, j, lcount, usz;
-	JSON_Value *jsch;
-	JSON_Array *jarr;
-	JSON_Object *jobj, **jobjs;
-        char *date, *p, *k, *base;
-	char vstdin[256];
-        struct aur_pkg *aur;
-	int fpkg;
-	size_t inum, didx;
+	if (aur == NULL) {
+		aur = new_aur_context();
+		aurpkg_set_progress_meter(aur, 1);
+		atexit(free_aur_context);
+	}
 
-	jsch = json_parse_string(json);
-	jobj = json_object(jsch);
-	jarr = json_object_get_array(jobj, "results");
-        lcount = (size_t)json_object_get_number(jobj, "resultcount");
+	return (aur);
+}
 
-	if (lcount == (size_t)0) {
-		fputs("error: no package results were found.\n",
-		      stderr);
-		return;
-	}
+/* Response of a plain request. */
+struct fetch_result {
+	enum aurpkg_error error;
+	long code;
+	char *resp;
+	char *message;
+};
 
-	/* JSON objects structure. */
-	jobjs = calloc(sizeof(struct JSON_Object *) * lcount,
-		       sizeof(char));
-	if (jobjs == NULL)
-		err(EXIT_FAILURE, "calloc()");
+/* Keep the response, once the request is done. */
+static void fetch_done(struct aurpkg_ctx *ctx,
+		       const struct aurpkg_result *res, void *udata)
+{
+	struct fetch_result *fr;
+
+	(void)ctx;
+	fr = (struct fetch_result *)udata;
+	fr->error = res->error;
+	fr->code = res->http_code;
+	fr->resp = strndup(res->body, res->body_len);
+	if (fr->resp == NULL)
+		err(EXIT_FAILURE, "strndup()");
+	if (res->message != NULL)
+		fr->message = strdup(res->message);
+}
 
-	/* aur_pkg structure. */
-	aur = calloc(sizeof(*aur) * lcount, sizeof(struct aur_pkg *));
-	if (aur == NULL)
-		err(EXIT_FAILURE, "calloc()");
+/* Do a plain request of path (relative to the endpoint) and return
+   the response buffer. HTTP status code is stored in code, if it's
+   not NULL. */
+static char *fetch_url_to_memory(const char *path, long *code)
+{
+	struct fetch_result fr;
+	int id;
+
+	memset(&fr, '\0', sizeof(struct fetch_result));
+	fr.error = AURPKG_ENET;
+	id = aurpkg_request(aur_context(), path, fetch_done, &fr);
+	if (id < 0)
+		errx(EXIT_FAILURE, "aurpkg_request(): %s",
+		     aurpkg_strerror((enum aurpkg_error)-id));
+
+	aurpkg_run(aur);
+	if (fr.error != AURPKG_OK)
+		errx(EXIT_FAILURE, "error: %s%s%s", aurpkg_strerror(fr.error),
+		     fr.message != NULL ? ": " : "",
+		     fr.message != NULL ? fr.message : "");
+
+	if (code != NULL)
+		*code = fr.code;
+	free(fr.message);
+	return (fr.resp);
+}
 
-	/* Set the each object to jobjs. */
-	for (i = 0; i < lcount; i++)
-		jobjs[i] = json_array_get_object(jarr, i);
+/* Take a single token from the shared request ledger. The ledger
+   is a token bucket that refills AUR_RATE_LIMIT tokens over every
+   AUR_RATE_WINDOW seconds, and it's locked with flock(), so all
+   running aurpkg processes spend from the same budget.
+   "spare" is the number of tokens that must be left after taking
+   one. Returns 1 if a token was taken, otherwise 0 and "wait" is
+   set to the seconds needed until we can take one. */
+static int ledger_take_token(const char *dir, double spare,
+			     unsigned int *wait)
+{
+	FILE *fp;
+	char *path;
+	size_t sz;
+	int fd, ret;
+	double tokens;
+	long long last;
+	time_t now;
+
+	sz = strlen(dir) + sizeof("/"LEDGER_FILE_NAME);
+	path = calloc(sz, sizeof(char));
+	if (path == NULL)
+		err(EXIT_FAILURE, "calloc()");
 
-	/* Sort the JSON structure, according whoever got the most
-	   votes, by swapping the pointers. */
-        qsort(jobjs, lcount, sizeof(JSON_Object *), sort_compare);
+	snprintf(path, sz, "%s/"LEDGER_FILE_NAME, dir);
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	free(path);
+	/* If we can't have a ledger, don't stop anyone. */
+	if (fd == -1)
+		return (1);
+
+	while (flock(fd, LOCK_EX) == -1) {
+		if (errno != EINTR) {
+			close(fd);
+			return (1);
+		}
+	}
 
-	/* Now sorted, so let's print each objects out. */
-	for (i = 0; i < lcount; i++) {
-		aur[i].name = json_object_get_string(jobjs[i], "Name");
-		aur[i].description = json_object_get_string(jobjs[i], "Description");
-		if (aur[i].description == NULL)
-			aur[i].description = "no description was specified";
-	        aur[i].version = json_object_get_string(jobjs[i], "Version");
-		if (aur[i].version == NULL)
-			aur[i].version = "unknown";
-		aur[i].numvotes = (uint32_t)json_object_get_number(jobjs[i], "NumVotes");
-		aur[i].popularity = json_object_get_number(jobjs[i], "Popularity");
-		aur[i].outdated = (time_t)json_object_get_number(jobjs[i], "OutOfDate");
-		/* If there are no maintainer, then the package is considerd orphaned. */
-		aur[i].maintainer = json_object_get_string(jobjs[i], "Maintainer");
+	fp = fdopen(fd, "r+");
+	if (fp == NULL)
+		err(EXIT_FAILURE, "fdopen()");
 
-		/* Apparently, package path may not be correct when using URLPath.
-		   Either because it's outdated or not updated in the AUR repository.
-		   To "fix" that use "PackageBase" as the archive name. */
-		aur[i].url_path = json_object_get_string(jobjs[i], "URLPath");
-		aur[i].url_base = json_object_get_string(jobjs[i], "PackageBase");
+	now = time(NULL);
+	/* A new (or broken) ledger starts with a full bucket. */
+	if (fscanf(fp, "%lf %lld", &tokens, &last) != 2) {
+		tokens = (double)AUR_RATE_LIMIT;
+		last = (long long)now;
 	}
 
-	/* Show colored output, if colors are enabled. */
-	if (enable_colors) {
-		for (i = 0, j = 1; i < lcount; i++, j++) {
-			fprintf(stdout, COLOR_PURPLE"%zu "
-				COLOR_BLUE"aur"COLOR_END"/", j);
-			fprintf(stdout, COLOR_WHITE"%s"COLOR_END
-				" "COLOR_BGREEN"(%s)"COLOR_END,
-				aur[i].name, aur[i].version);
-			fprintf(stdout, COLOR_WHITE" (+%u %.2lf%%)"COLOR_END,
-				aur[i].numvotes, aur[i].popularity);
-
-			/* Is there no maintainer? Package must be orphaned. */
-			if (aur[i].maintainer == NULL)
-			        fputs(COLOR_BRED" (Orphaned)"COLOR_END, stdout);
-
-			/* Is the package out-of-date? */
-			if (aur[i].outdated > 0) {
-				date = pretty_time(aur[i].outdated);
-				fprintf(stdout, COLOR_BRED" (Out-of-date: %s)"COLOR_END,
-					date);
-				free(date);
-			}
-			fprintf(stdout, "\n ~> %s\n", aur[i].description);
-		}
+	/* Refill, proportional to the time passed since last time. */
+	if ((long long)now > last)
+		tokens += (double)((long long)now - last) *
+			AUR_RATE_LIMIT / AUR_RATE_WINDOW;
+	if (tokens > (double)AUR_RATE_LIMIT)
+		tokens = (double)AUR_RATE_LIMIT;
 
-		fputs(COLOR_BLUE":: "COLOR_END, stdout);
-		fputs(COLOR_WHITE"Packages to install (eg: 1 2 3):\n", stdout);
-		fputs(COLOR_BLUE":: "COLOR_END, stdout);
-		/* The last fputs doesn't uses a newline to flush the
-		   stdout output. So we need to flush it manually. */
-		fflush(stdout);
+	if (tokens - 1.0 >= spare) {
+		tokens -= 1.0;
+		ret = 1;
 	} else {
-		for (i = 0, j = 1; i < lcount; i++, j++) {
-			fprintf(stdout, "%zu aur/", j);
-			fprintf(stdout, "%s (%s)", aur[i].name,
-				aur[i].version);
-			fprintf(stdout, " (+%u %.2lf%%)", aur[i].numvotes,
-				aur[i].popularity);
-
-			/* Is there no maintainer? Package must be orphaned. */
-			if (aur[i].maintainer == NULL)
-			        fputs(" (Orphaned)", stdout);
-
-			/* Is the package out-of-date? */
-			if (aur[i].outdated > 0) {
-				date = pretty_time(aur[i].outdated);
-				fprintf(stdout, " (Out-of-date: %s)", date);
-				free(date);
-			}
-			fprintf(stdout, "\n ~> %s\n", aur[i].description);
-		}
-
-		fputs(":: ", stdout);
-		fputs("Packages to install (eg: 1 2 3):\n", stdout);
-		fputs(":: ", stdout);
-		fflush(stdout);
+		*wait = (unsigned int)((spare + 1.0 - tokens) *
+				       AUR_RATE_WINDOW / AUR_RATE_LIMIT) + 1;
+		ret = 0;
 	}
 
-	/* This section is for reading the input stream and parse
-	   that stream. After that, download the specific tarball
-	   which was provided by the input. */
+	rewind(fp);
+	if (ftruncate(fd, (off_t)0) == -1)
+		warn("ftruncate()");
+	fprintf(fp, "%.4f %lld\n", tokens, (long long)now);
 
-        /* Fill the buffers with zeros. */
-	memset(vstdin, '\0', sizeof(vstdin));
-	/* Read input from standard input. */
-	read(STDIN_FILENO, vstdin, sizeof(vstdin));
+	/* Closing it will also release the lock. */
+	fclose(fp);
+	return (ret);
+}
 
-	/* Setup variables. */
-	p = vstdin;
-	fpkg = 0;
-        didx = 1;
+/* Remove the cached responses (and their locks), which weren't
+   fetched again for AUR_CACHE_MAX_AGE. A lock is judged by its
+   response's age, and it's only removed when nobody holds it. Anyone
+   still waiting on it sees that, and takes the new one. */
+static void prune_request_cache(const char *dir)
+{
+	DIR *dp;
+	struct dirent *de;
+	struct stat st;
+	char path[PATH_MAX];
+	time_t now;
+	int fd;
+
+	dp = opendir(dir);
+	if (dp == NULL)
+		return;
 
-	while (*p != '\0') {
-		/* If there are space(s), consume and ignore them. */
-		if (*p == ' ') {
-			p++;
+	now = time(NULL);
+	while ((de = readdir(dp)) != NULL) {
+		/* Only "<16 hex digits>.json" and ".lock" are ours. */
+		if (strlen(de->d_name) != (size_t)21 ||
+		    strspn(de->d_name, "0123456789abcdef") != (size_t)16 ||
+		    (strcmp(de->d_name + 16, ".json") != 0 &&
+		     strcmp(de->d_name + 16, ".lock") != 0))
 			continue;
+
+		snprintf(path, sizeof(path), "%s/%.16s.json", dir, de->d_name);
+		if (stat(path, &st) == -1) {
+			/* No response yet, the lock may be for the first. */
+			snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+			if (stat(path, &st) == -1)
+				continue;
 		}
+		if (now - st.st_mtime < AUR_CACHE_MAX_AGE)
+			continue;
 
-		/* Extract the number. */
-		inum = safe_atoul(p);
-		if (lcount > 1 && inum == 0) {
-			/* Keep consuming, even if there are no
-			   numbers left. */
-			p++;
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		if (de->d_name[17] == 'j') {
+			unlink(path);
 			continue;
 		}
-		/* If it's just a the single number (first package),
-		   and we didn't looped through, print that we couldn't
-		   able to find anything related. */
-		if (fpkg == 0) {
-			if ((inum - 1) > lcount || aur[inum - 1].url_path == NULL) {
-				fputs(" there is nothing to do\n", stderr);
-				goto out_cleanup;
-			}
-		}
 
-		/* lcount is (lcount + 1), so we need to subtract 1.
-		   If inum (package input number) is bigger than
-		   total number of packages, ignore it and continue
-		   the loop. */
-		if ((inum - 1) <= (lcount - 1)) {
-			/* If URL is missing. The upper branch is to check
-			   whether if we overflow than lcount, as it's not
-			   possible to index if inum > lcount. */
-			/* aur[inum].url_path */
-			usz = sizeof(AUR_BASE_URL) + strlen(aur[inum - 1].url_path);
-			k = calloc(usz, sizeof(char));
-			if (k == NULL)
-				err(EXIT_FAILURE, "calloc()");
+		fd = open(path, O_RDWR | O_CLOEXEC);
+		if (fd == -1)
+			continue;
+		if (flock(fd, LOCK_EX | LOCK_NB) == 0)
+			unlink(path);
+		/* Closing it will also release the lock. */
+		close(fd);
+	}
 
-			base = base_name(aur[inum - 1].url_path);
-			if (base == NULL)
-				errx(EXIT_FAILURE, "base_name(): Parsed URL is invalid.");
+	closedir(dp);
+}
 
-			/* Colors. */
-			if (enable_colors)
-		        	fprintf(stdout, COLOR_BLUE":: "
-					COLOR_PURPLE"(%zu) "
-					COLOR_WHITE"Downloading %s...\n"COLOR_END,
-					didx, base);
-		        else
-			        fprintf(stdout,
-					":: (%zu) "
-					"Downloading %s...\n", didx, base);
-
-			snprintf(k, usz, "%s/"AUR_CGIT_PATH"/%s.tar.gz", AUR_BASE_URL,
-				 aur[inum - 1].url_base);
-			download_from_url(base, k, 0);
-
-			/* Colors. */
-			if (enable_colors)
-			        fprintf(stdout,
-					COLOR_BLUE":: "COLOR_WHITE
-					"~> Extracting %s...\n"COLOR_END, base);
-			else
-			        fprintf(stdout, ":: ~> Extracting %s...\n", base);
+/* Do a request, but spend from the shared request budget, and
+   coalesce it with other aurpkg processes. The process which gets
+   the path's lock fetches it and writes the response to the cache,
+   others wait on that lock and read the response once it's done.
+   When the budget is running low, cached data is used (even if
+   it's stale), and if there's no cache, we'll pace ourselves. */
+static char *budgeted_request(const char *path)
+{
+	static int pruned;
+	char *dir, *lpath, *rpath, *resp;
+	size_t sz;
+	int fd, have_cache;
+	unsigned int wait;
+	long code;
+	uint64_t h;
+	struct stat st, lst;
+
+	dir = cache_dir_path();
+	if (dir == NULL)
+		return (fetch_url_to_memory(path, NULL));
+
+	/* Once a run is enough. */
+	if (pruned == 0) {
+		prune_request_cache(dir);
+		pruned = 1;
+	}
+
+	h = fnv1a_hash(path);
+	sz = strlen(dir) + (size_t)32;
+	lpath = calloc(sz, sizeof(char));
+	rpath = calloc(sz, sizeof(char));
+	if (lpath == NULL || rpath == NULL)
+		err(EXIT_FAILURE, "calloc()");
 
-			/* Check whether the file is a gzipped tarball or not. */
-			if (likely_targz_magic_sig(base) == 0)
-				errx(EXIT_FAILURE,
-				     "error: Downloaded archive is not "
-				     "a gzipped tarball.");
+	snprintf(lpath, sz, "%s/%016llx.lock", dir, (unsigned long long)h);
+	snprintf(rpath, sz, "%s/%016llx.json", dir, (unsigned long long)h);
 
-			/* Decompress the gzipped tarball. */
-			targz_decompress_archive(base);
+	/* Only one process gets to fetch this path at a time. If the
+	   lock was pruned while we were waiting, ours is the orphaned
+	   file, and a new one (which others lock) is there. */
+	for (;;) {
+		fd = open(lpath, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if (fd == -1)
+			break;
+		while (flock(fd, LOCK_EX) == -1 && errno == EINTR)
+			;
+		if (fstat(fd, &st) == 0 && stat(lpath, &lst) == 0 &&
+		    st.st_dev == lst.st_dev && st.st_ino == lst.st_ino)
+			break;
+		close(fd);
+	}
 
-			/* Use the url basename, as it'd be the name of
-			   the directory after the extraction. */
-		        makepkg_and_install(aur[inum - 1].url_base);
-			free(k);
+	resp = NULL;
+	have_cache = stat(rpath, &st) == 0;
+
+	/* Someone just fetched it (may be while we were waiting). */
+	if (have_cache && time(NULL) - st.st_mtime < AUR_COALESCE_SECS)
+		resp = read_whole_file(rpath);
+
+	while (resp == NULL) {
+		/* Keep some reserve, if we can afford to use the cache. */
+		if (ledger_take_token(dir, have_cache ?
+				      (double)AUR_RATE_RESERVE : 0.0,
+				      &wait) == 0) {
+			if (have_cache) {
+				resp = read_whole_file(rpath);
+				if (resp != NULL) {
+					fputs("warning: request budget is low, "
+					      "using cached response.\n", stderr);
+					break;
+				}
+				have_cache = 0;
+				continue;
+			}
 
-			/* How many packages we've downloaded? */
-			didx++;
+			fprintf(stderr, "warning: request budget is exhausted, "
+				"waiting %u seconds...\n", wait);
+			sleep(wait);
+			continue;
 		}
 
-		/* Break if there's a tab character. They're not handy
-		   while working with this. It will parse the first character
-		   and will only break if there's any tab character after this. */
-		if (*p == '\t')
-			goto out_cleanup;
-
-		/* Consume the next character(s) (number) until we
-		   reach a space character. Then we can just pass
-		   it to over safe_atoi() which will trim these
-		   additional spaces automatically. */
-		while (*p != ' ')
-			p++;
+		code = 0;
+		resp = fetch_url_to_memory(path, &code);
+		if (code == 429) {
+			/* The server disagrees with our ledger. */
+			free(resp);
+			resp = have_cache ? read_whole_file(rpath) : NULL;
+			if (resp == NULL)
+				errx(EXIT_FAILURE, "error: too many requests "
+				     "to the AUR, try again later.");
+			fputs("warning: too many requests, "
+			      "using cached response.\n", stderr);
+		} else if (resp == NULL) {
+			errx(EXIT_FAILURE, "error: no response from the AUR "
+			     "(HTTP %ld).", code);
+		} else if (code == 200) {
+			write_whole_file(rpath, resp);
+		}
 
-		/* We got our first package. */ 
-		fpkg = 1;
+		/* Any other answer goes to the caller as is, it isn't
+		   cached and isn't asked again. */
+		break;
 	}
 
-	/* If not a single package is there. For example,
-	   when you input characters that are not numbers,
-	   this will trigger. */
-	if (fpkg == 0)
-		fputs(" there is nothing to do\n", stderr);
+	/* Closing it will also release the lock. */
+	if (fd != -1)
+		close(fd);
+	free(lpath);
+	free(rpath);
+	free(dir);
+	return (resp);
+}
 
-out_cleanup:
-	json_value_free(jsch);
-	free(jobjs);
-	free(aur);
+/* Compiler caches, set up for a single package build. Each build
+   has its own sccache server, on its own port. */
+struct build_cache {
+	char *ccache_dir;
+	char *sccache_dir;
+	char *conf;
+	char sccache_port[8];
+};
+
+/* Create the directory, if it doesn't exist already. */
+static int make_dir(const char *dir)
+{
+	if (mkdir(dir, 0755) == -1 && errno != EEXIST)
+		return (-1);
+	return (0);
 }
 
-/* Request for AUR package information. */
-static char *request_aur_info_endpoint(const char *url)
+/* Run a program, and if out isn't NULL, store its standard output
+   there. Environment variables of the build cache will be set. */
+static int run_cache_tool(const struct build_cache *bc, char *const argv[],
+			  char **out)
 {
-        CURL *curl;
+	pid_t pid;
+	int pfd[2], status;
 	struct curl_memory cm;
-	int ret;
+	char buf[4096];
+	ssize_t n;
 
-	curl = curl_easy_init();
-	if (curl == NULL)
-		err(EXIT_FAILURE, "curl_easy_init()");
+	if (out != NULL && pipe(pfd) == -1)
+		err(EXIT_FAILURE, "pipe()");
 
-	memset(&cm, '\0', sizeof(struct curl_memory));
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, (long)1);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&cm);
+	pid = fork();
+	if (pid == (pid_t)-1)
+		err(EXIT_FAILURE, "fork()");
 
-	ret = curl_easy_perform(curl);
-	curl_easy_cleanup(curl);
-	curl_global_cleanup();
+	if (pid == (pid_t)0) {
+		if (out != NULL) {
+			dup2(pfd[1], STDOUT_FILENO);
+			close(pfd[0]);
+			close(pfd[1]);
+		}
+		if (bc->ccache_dir != NULL)
+			setenv("CCACHE_DIR", bc->ccache_dir, 1);
+		if (bc->sccache_dir != NULL) {
+			setenv("SCCACHE_DIR", bc->sccache_dir, 1);
+			setenv("SCCACHE_SERVER_PORT", bc->sccache_port, 1);
+			/* It's stopped after the build, not before. */
+			setenv("SCCACHE_IDLE_TIMEOUT", "0", 1);
+		}
 
-	if (ret != CURLE_OK)
-		err(EXIT_FAILURE, "curl_easy_perform()");
+		execv(argv[0], argv);
+		_exit(127);
+	}
 
-	/* Return the response.  */
-	return (cm.resp);
+	if (out != NULL) {
+		close(pfd[1]);
+		memset(&cm, '\0', sizeof(struct curl_memory));
+		while ((n = read(pfd[0], buf, sizeof(buf))) != 0) {
+			if (n == -1) {
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			curl_write_cb(buf, (size_t)1, (size_t)n, &cm);
+		}
+		close(pfd[0]);
+		*out = cm.resp;
+	}
+
+	while (waitpid(pid, &status, 0) < 0)
+		;
+
+	return (status);
 }
 
-/* Format the AUR_INFO_URL. */
-static char *format_info_package(const char *pkg)
+/* Run a program in dir (or here, if it's NULL). If in isn't NULL,
+   it's written to its standard input, and if out isn't NULL, its
+   standard output is stored there (and its complaints are discarded).
+   Both are done at the same time, so neither side blocks the other.
+   Returns its exit status. */
+static int run_program(const char *dir, char *const argv[], const char *in,
+		       size_t insz, char **out)
 {
-        char *p;
-	size_t asz;
+	pid_t pid;
+	int ifd[2], ofd[2], status, fd, maxfd;
+	struct curl_memory cm;
+	struct sigaction ign, opipe;
+	char buf[4096];
+	ssize_t n;
+	fd_set rfds, wfds;
 
-	asz = strlen(pkg);
-	p = calloc((size_t)9 + asz + sizeof(AUR_INFO_URL), sizeof(char));
-	if (p == NULL)
-		err(EXIT_FAILURE, "calloc()");
+	if (in != NULL && pipe(ifd) == -1)
+		err(EXIT_FAILURE, "pipe()");
+	if (out != NULL && pipe(ofd) == -1)
+		err(EXIT_FAILURE, "pipe()");
 
-	/* Add proper size and name. */
-	memcpy(p, AUR_INFO_URL, sizeof(AUR_INFO_URL) - 1);
-        memcpy(p + sizeof(AUR_INFO_URL) - 1, "?arg[]=", (size_t)7);
-	memcpy(p + sizeof(AUR_INFO_URL) - 1 + (size_t)7, pkg, asz);
+	fflush(stdout);
+	pid = fork();
+	if (pid == (pid_t)-1)
+		err(EXIT_FAILURE, "fork()");
 
-        return (p);
+	if (pid == (pid_t)0) {
+		if (dir != NULL && chdir(dir) == -1)
+			_exit(127);
+		if (in != NULL) {
+			dup2(ifd[0], STDIN_FILENO);
+			close(ifd[0]);
+			close(ifd[1]);
+		}
+		if (out != NULL) {
+			dup2(ofd[1], STDOUT_FILENO);
+			close(ofd[0]);
+			close(ofd[1]);
+			fd = open("/dev/null", O_WRONLY);
+			if (fd != -1)
+				dup2(fd, STDERR_FILENO);
+		}
+
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	ifd[1] = in != NULL ? ifd[1] : -1;
+	ofd[0] = out != NULL ? ofd[0] : -1;
+	if (in != NULL)
+		close(ifd[0]);
+	if (out != NULL)
+		close(ofd[1]);
+	if (ifd[1] != -1 && insz == 0) {
+		close(ifd[1]);
+		ifd[1] = -1;
+	}
+	/* It may quit before reading everything. */
+	memset(&ign, '\0', sizeof(struct sigaction));
+	ign.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &ign, &opipe);
+
+	memset(&cm, '\0', sizeof(struct curl_memory));
+	while (ifd[1] != -1 || ofd[0] != -1) {
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		maxfd = -1;
+		if (ifd[1] != -1) {
+			FD_SET(ifd[1], &wfds);
+			maxfd = ifd[1];
+		}
+		if (ofd[0] != -1) {
+			FD_SET(ofd[0], &rfds);
+			if (ofd[0] > maxfd)
+				maxfd = ofd[0];
+		}
+		if (select(maxfd + 1, &rfds, &wfds, NULL, NULL) == -1) {
+			if (errno == EINTR)
+				continue;
+			err(EXIT_FAILURE, "select()");
+		}
+
+		if (ifd[1] != -1 && FD_ISSET(ifd[1], &wfds)) {
+			/* Up to PIPE_BUF never blocks, once it's writable. */
+			n = write(ifd[1], in, insz < (size_t)PIPE_BUF ?
+				  insz : (size_t)PIPE_BUF);
+			if (n > 0) {
+				in += n;
+				insz -= (size_t)n;
+			}
+			/* Done, or it doesn't read anymore. */
+			if (insz == 0 || (n == -1 && errno != EINTR &&
+					  errno != EAGAIN)) {
+				close(ifd[1]);
+				ifd[1] = -1;
+			}
+		}
+
+		if (ofd[0] != -1 && FD_ISSET(ofd[0], &rfds)) {
+			n = read(ofd[0], buf, sizeof(buf));
+			if (n > 0) {
+				curl_write_cb(buf, (size_t)1, (size_t)n, &cm);
+			} else if (n == 0 || errno != EINTR) {
+				close(ofd[0]);
+				ofd[0] = -1;
+			}
+		}
+	}
+	sigaction(SIGPIPE, &opipe, NULL);
+	if (out != NULL)
+		*out = cm.resp;
+
+	while (waitpid(pid, &status, 0) < 0)
+		;
+
+	return (status);
+}
+
+/* Append the values of field in the package base's .SRCINFO
+   to out, each followed by a space. Returns -1, if there's no
+   .SRCINFO. */
+static int read_srcinfo(const char *pbase, const char *field,
+			struct curl_memory *out)
+{
+	char *path, *info, *line, *sv, *p;
+	size_t sz, len;
+
+	sz = strlen(pbase) + sizeof("/.SRCINFO");
+	path = calloc(sz, sizeof(char));
+	if (path == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	snprintf(path, sz, "%s/.SRCINFO", pbase);
+	info = read_whole_file(path);
+	free(path);
+	if (info == NULL)
+		return (-1);
+
+	len = strlen(field);
+	for (line = strtok_r(info, "\n", &sv); line != NULL;
+	     line = strtok_r(NULL, "\n", &sv)) {
+		line += strspn(line, " \t");
+		if (strncmp(line, field, len) != 0)
+			continue;
+		p = line + len;
+		p += strspn(p, " \t");
+		if (*p++ != '=')
+			continue;
+		p += strspn(p, " \t");
+		p[strcspn(p, " \t")] = '\0';
+		if (*p != '\0')
+			mem_append(out, "%s ", p);
+	}
+
+	free(info);
+	return (0);
+}
+
+/* Find a free TCP port on the loopback, for a private sccache
+   server. Returns 0, if there's none. */
+static unsigned int free_local_port(void)
+{
+	struct sockaddr_in sa;
+	socklen_t len;
+	unsigned int port;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return (0);
+
+	/* Port 0 lets the kernel choose. */
+	memset(&sa, '\0', sizeof(struct sockaddr_in));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	len = sizeof(struct sockaddr_in);
+	port = 0;
+	if (bind(fd, (struct sockaddr *)&sa, len) == 0 &&
+	    getsockname(fd, (struct sockaddr *)&sa, &len) == 0)
+		port = ntohs(sa.sin_port);
+
+	close(fd);
+	return (port);
+}
+
+/* Set up ccache and/or sccache for the package base. Each base
+   gets its own cache directory, so packages don't evict each other.
+   makepkg's "ccache" BUILDENV option is enabled with a config that
+   sources the system's and the user's makepkg.conf, like makepkg
+   does when MAKEPKG_CONF isn't set, and then turns it on. */
+static void setup_build_cache(const char *pkgbase, struct build_cache *bc)
+{
+	char *dir, *p;
+	size_t sz;
+	unsigned int port;
+	char *zargv[] = { DEFAULT_CCACHE_PATH, "-z", NULL };
+	char *sargv[] = { DEFAULT_SCCACHE_PATH, "--start-server", NULL };
+	static const char overlay[] =
+		"# Generated by aurpkg, do not edit.\n"
+		"source "DEFAULT_MAKEPKG_CONF"\n"
+		"for f in "DEFAULT_MAKEPKG_CONF".d/*.conf; do\n"
+		"\t[[ -f $f ]] && source \"$f\"\n"
+		"done\n"
+		"f=\"${XDG_CONFIG_HOME:-$HOME/.config}/pacman/makepkg.conf\"\n"
+		"if [[ -r $f ]]; then\n"
+		"\tsource \"$f\"\n"
+		"elif [[ -r $HOME/.makepkg.conf ]]; then\n"
+		"\tsource \"$HOME/.makepkg.conf\"\n"
+		"fi\n"
+		"unset f\n"
+		"BUILDENV=(\"${BUILDENV[@]/#!ccache/ccache}\")\n"
+		"[[ \" ${BUILDENV[*]} \" == *\" ccache \"* ]] || "
+		"BUILDENV+=(ccache)\n";
+
+	memset(bc, '\0', sizeof(struct build_cache));
+
+	/* Package bases can't have slashes, but be careful anyway. */
+	if (strchr(pkgbase, '/') != NULL || pkgbase[0] == '.')
+		return;
+
+	dir = cache_dir_path();
+	if (dir == NULL) {
+		fputs("warning: no cache directory, compiler cache "
+		      "is disabled.\n", stderr);
+		return;
+	}
+
+	sz = strlen(dir) + strlen(pkgbase) + sizeof("/sccache/") +
+		sizeof(CCACHE_OVERLAY_NAME);
+	if (access(DEFAULT_CCACHE_PATH, X_OK) == 0) {
+		p = calloc(sz, sizeof(char));
+		if (p == NULL)
+			err(EXIT_FAILURE, "calloc()");
+
+		snprintf(p, sz, "%s/"CCACHE_OVERLAY_NAME, dir);
+		write_whole_file(p, overlay);
+		bc->conf = p;
+
+		p = calloc(sz, sizeof(char));
+		if (p == NULL)
+			err(EXIT_FAILURE, "calloc()");
+
+		snprintf(p, sz, "%s/ccache", dir);
+		make_dir(p);
+		snprintf(p, sz, "%s/ccache/%s", dir, pkgbase);
+		if (make_dir(p) == -1) {
+			warn("mkdir()");
+			free(p);
+		} else {
+			bc->ccache_dir = p;
+		}
+	}
+
+	if (access(DEFAULT_SCCACHE_PATH, X_OK) == 0) {
+		p = calloc(sz, sizeof(char));
+		if (p == NULL)
+			err(EXIT_FAILURE, "calloc()");
+
+		snprintf(p, sz, "%s/sccache", dir);
+		make_dir(p);
+		snprintf(p, sz, "%s/sccache/%s", dir, pkgbase);
+		if (make_dir(p) == -1) {
+			warn("mkdir()");
+			free(p);
+		} else {
+			bc->sccache_dir = p;
+		}
+	}
+
+	if (bc->ccache_dir == NULL && bc->sccache_dir == NULL)
+		fputs("warning: neither 'ccache' nor 'sccache' "
+		      "is installed.\n", stderr);
+
+	/* Start from zero, so we only report this build. */
+	if (bc->ccache_dir != NULL) {
+		run_cache_tool(bc, zargv, &p);
+		free(p);
+	}
+
+	/* A server of our own, which reads our SCCACHE_DIR and starts
+	   from zero. Servers of others are left alone. */
+	if (bc->sccache_dir != NULL) {
+		port = free_local_port();
+		snprintf(bc->sccache_port, sizeof(bc->sccache_port), "%u", port);
+		p = NULL;
+		if (port == 0 || run_cache_tool(bc, sargv, &p) != 0) {
+			fputs("warning: cannot start an 'sccache' server, "
+			      "sccache is disabled.\n", stderr);
+			free(bc->sccache_dir);
+			bc->sccache_dir = NULL;
+		}
+		free(p);
+	}
+
+	free(dir);
+}
+
+/* Set the environment for makepkg, called from the child. */
+static void apply_build_cache(const struct build_cache *bc)
+{
+	if (bc->ccache_dir != NULL) {
+		setenv("CCACHE_DIR", bc->ccache_dir, 1);
+		setenv("MAKEPKG_CONF", bc->conf, 1);
+	}
+
+	if (bc->sccache_dir != NULL) {
+		setenv("SCCACHE_DIR", bc->sccache_dir, 1);
+		setenv("SCCACHE_SERVER_PORT", bc->sccache_port, 1);
+		setenv("SCCACHE_IDLE_TIMEOUT", "0", 1);
+		setenv("RUSTC_WRAPPER", DEFAULT_SCCACHE_PATH, 1);
+	}
+}
+
+/* Print the hit rate of a compiler cache. */
+static void print_cache_rate(const char *tool, const char *pkgbase,
+			     unsigned long long hits, unsigned long long misses,
+			     int enable_colors)
+{
+	double rate;
+
+	rate = hits + misses == 0 ? 0.0 :
+		100.0 * (double)hits / (double)(hits + misses);
+	if (enable_colors)
+		fprintf(stdout, COLOR_BLUE":: "COLOR_WHITE
+			"%s (%s): %llu hits, %llu misses (%.1lf%%)\n"
+			COLOR_END, tool, pkgbase, hits, misses, rate);
+	else
+		fprintf(stdout, ":: %s (%s): %llu hits, %llu misses "
+			"(%.1lf%%)\n", tool, pkgbase, hits, misses, rate);
+}
+
+/* Print the cache hit rates of the build, and free the build cache. */
+static void report_build_cache(const char *pkgbase, struct build_cache *bc,
+			       int enable_colors)
+{
+	char *out, *line, *sp, *tab, *num;
+	unsigned long long v, hits, misses;
+	int is_hit;
+	char *pargv[] = { DEFAULT_CCACHE_PATH, "--print-stats", NULL };
+	char *sargv[] = { DEFAULT_SCCACHE_PATH, "--show-stats", NULL };
+	char *targv[] = { DEFAULT_SCCACHE_PATH, "--stop-server", NULL };
+
+	if (bc->ccache_dir != NULL) {
+		out = NULL;
+		hits = misses = 0;
+		run_cache_tool(bc, pargv, &out);
+
+		/* It's a "key<TAB>value" list. Key names are
+		   different between ccache 3 and 4. */
+		for (line = strtok_r(out, "\n", &sp); line != NULL;
+		     line = strtok_r(NULL, "\n", &sp)) {
+			tab = strchr(line, '\t');
+			if (tab == NULL)
+				continue;
+
+			*tab = '\0';
+			v = strtoull(tab + 1, (char **)NULL, 10);
+			if (strcmp(line, "direct_cache_hit") == 0 ||
+			    strcmp(line, "preprocessed_cache_hit") == 0 ||
+			    strcmp(line, "cache_hit_direct") == 0 ||
+			    strcmp(line, "cache_hit_preprocessed") == 0)
+				hits += v;
+			else if (strcmp(line, "cache_miss") == 0)
+				misses += v;
+		}
+		free(out);
+		print_cache_rate("ccache", pkgbase, hits, misses,
+				 enable_colors);
+	}
+
+	if (bc->sccache_dir != NULL) {
+		out = NULL;
+		hits = misses = 0;
+		run_cache_tool(bc, sargv, &out);
+
+		/* Lines are "Cache hits    12", there are also
+		   "Cache hits (Rust)  12" and "Cache hits rate ..." ones,
+		   which aren't followed by the number. */
+		for (line = strtok_r(out, "\n", &sp); line != NULL;
+		     line = strtok_r(NULL, "\n", &sp)) {
+			if (strncmp(line, "Cache hits", (size_t)10) == 0)
+				num = line + 10;
+			else if (strncmp(line, "Cache misses", (size_t)12) == 0)
+				num = line + 12;
+			else
+				continue;
+
+			is_hit = num == line + 10;
+			num += strspn(num, " \t");
+			if (isdigit((unsigned char)*num) == 0)
+				continue;
+			v = strtoull(num, (char **)NULL, 10);
+			if (is_hit)
+				hits += v;
+			else
+				misses += v;
+		}
+		free(out);
+		print_cache_rate("sccache", pkgbase, hits, misses,
+				 enable_colors);
+
+		/* Only ours, the one on our port. */
+		out = NULL;
+		run_cache_tool(bc, targv, &out);
+		free(out);
+	}
+
+	free(bc->ccache_dir);
+	free(bc->sccache_dir);
+	free(bc->conf);
+}
+
+/* Fields of a package's .PKGINFO, as they go to the repository's
+   desc entry. Fields with more than one value have a line each. */
+static const char *const repo_desc_fields[][2] = {
+	{ "%NAME%",         "pkgname" },
+	{ "%BASE%",         "pkgbase" },
+	{ "%VERSION%",      "pkgver" },
+	{ "%DESC%",         "pkgdesc" },
+	{ "%GROUPS%",       "group" },
+	{ "%ISIZE%",        "size" },
+	{ "%URL%",          "url" },
+	{ "%LICENSE%",      "license" },
+	{ "%ARCH%",         "arch" },
+	{ "%BUILDDATE%",    "builddate" },
+	{ "%PACKAGER%",     "packager" },
+	{ "%REPLACES%",     "replaces" },
+	{ "%CONFLICTS%",    "conflict" },
+	{ "%PROVIDES%",     "provides" },
+	{ "%DEPENDS%",      "depend" },
+	{ "%OPTDEPENDS%",   "optdepend" },
+	{ "%MAKEDEPENDS%",  "makedepend" },
+	{ "%CHECKDEPENDS%", "checkdepend" },
+};
+
+/* A package, which is being added to the repository. */
+struct repo_pkg {
+	char *name;
+	char *dir;
+	char *desc;
+	char *files;
+};
+
+/* Append the values of key in the .PKGINFO (one per line). */
+static void pkginfo_values(const char *info, const char *key,
+			   struct curl_memory *out)
+{
+	const char *line, *p;
+	size_t klen, len;
+
+	klen = strlen(key);
+	for (line = info; *line != '\0'; line += len + (line[len] == '\n')) {
+		len = strcspn(line, "\n");
+		if (strncmp(line, key, klen) != 0 ||
+		    strncmp(line + klen, " = ", (size_t)3) != 0)
+			continue;
+		p = line + klen + 3;
+		mem_append(out, "%.*s\n", (int)(len - klen - 3), p);
+	}
+}
+
+/* Read the metadata of a package file (with bsdtar, as it can be
+   compressed with anything), and its file list. Returns -1, if it
+   isn't a package. */
+static int read_repo_pkg(const char *path, const char *file,
+			 struct repo_pkg *rp)
+{
+	struct curl_memory desc, vals, files;
+	struct stat st;
+	char *info, *list, *sum, *line, *sv;
+	size_t i;
+	int ret;
+	char *iargv[] = { DEFAULT_BSDTAR_PATH, "-xOf", (char *)path,
+			  ".PKGINFO", NULL };
+	char *largv[] = { DEFAULT_BSDTAR_PATH, "-tf", (char *)path, NULL };
+	char *sargv[] = { DEFAULT_SHA256SUM_PATH, (char *)path, NULL };
+
+	memset(rp, '\0', sizeof(struct repo_pkg));
+	info = list = sum = NULL;
+	ret = -1;
+	if (stat(path, &st) == -1 ||
+	    run_program(NULL, iargv, NULL, 0, &info) != 0 || info == NULL ||
+	    run_program(NULL, largv, NULL, 0, &list) != 0 || list == NULL ||
+	    run_program(NULL, sargv, NULL, 0, &sum) != 0 || sum == NULL)
+		goto out;
+
+	/* Directory of the entry is "<pkgname>-<pkgver>". */
+	memset(&vals, '\0', sizeof(struct curl_memory));
+	pkginfo_values(info, "pkgname", &vals);
+	pkginfo_values(info, "pkgver", &vals);
+	line = vals.resp == NULL ? NULL : strchr(vals.resp, '\n');
+	if (line == NULL || line[1] == '\0') {
+		free(vals.resp);
+		goto out;
+	}
+	*line++ = '\0';
+	line[strcspn(line, "\n")] = '\0';
+	rp->name = strdup(vals.resp);
+	memset(&desc, '\0', sizeof(struct curl_memory));
+	mem_append(&desc, "%s-%s", vals.resp, line);
+	rp->dir = desc.resp;
+	free(vals.resp);
+	if (rp->name == NULL)
+		err(EXIT_FAILURE, "strdup()");
+
+	memset(&desc, '\0', sizeof(struct curl_memory));
+	mem_append(&desc, "%%FILENAME%%\n%s\n\n", file);
+	for (i = 0; i < ARRAY_SIZE(repo_desc_fields); i++) {
+		memset(&vals, '\0', sizeof(struct curl_memory));
+		pkginfo_values(info, repo_desc_fields[i][1], &vals);
+		if (vals.nsz > 0)
+			mem_append(&desc, "%s\n%s\n", repo_desc_fields[i][0],
+				   vals.resp);
+		free(vals.resp);
+	}
+	sum[strcspn(sum, " \t\n")] = '\0';
+	mem_append(&desc, "%%CSIZE%%\n%lld\n\n%%SHA256SUM%%\n%s\n\n",
+		   (long long)st.st_size, sum);
+	rp->desc = desc.resp;
+
+	/* Metadata files of the package aren't installed. */
+	memset(&files, '\0', sizeof(struct curl_memory));
+	mem_append(&files, "%%FILES%%\n");
+	for (line = strtok_r(list, "\n", &sv); line != NULL;
+	     line = strtok_r(NULL, "\n", &sv))
+		if (*line != '.')
+			mem_append(&files, "%s\n", line);
+	rp->files = files.resp;
+	ret = 0;
+
+out:
+	free(info);
+	free(list);
+	free(sum);
+	return (ret);
+}
+
+/* Write a ustar header. Long names are split into the prefix. */
+static int tar_header(unsigned char hdr[512], const char *name, char type,
+		      size_t size, time_t mtime)
+{
+	const char *slash;
+	char num[24];
+	size_t len, sum, i;
+
+	/* Sizes and times have 11 octal digits. */
+	if ((unsigned long long)size > 077777777777ULL)
+		return (-1);
+
+	memset(hdr, '\0', (size_t)512);
+	len = strlen(name);
+	if (len < 100) {
+		memcpy(hdr, name, len);
+	} else {
+		slash = memchr(name, '/', len);
+		if (slash == NULL || (size_t)(slash - name) > 155 ||
+		    len - (size_t)(slash - name) - 1 >= 100)
+			return (-1);
+		memcpy(hdr + 345, name, (size_t)(slash - name));
+		memcpy(hdr, slash + 1, len - (size_t)(slash - name) - 1);
+	}
+
+	snprintf((char *)hdr + 100, (size_t)8, "%07o", type == '5' ? 0755 : 0644);
+	snprintf((char *)hdr + 108, (size_t)8, "%07o", 0);
+	snprintf((char *)hdr + 116, (size_t)8, "%07o", 0);
+	snprintf(num, sizeof(num), "%011llo", (unsigned long long)size);
+	memcpy(hdr + 124, num, (size_t)12);
+	snprintf(num, sizeof(num), "%011llo",
+		 (unsigned long long)mtime & 077777777777ULL);
+	memcpy(hdr + 136, num, (size_t)12);
+	hdr[156] = (unsigned char)type;
+	memcpy(hdr + 257, "ustar", (size_t)6);
+	memcpy(hdr + 263, "00", (size_t)2);
+	memcpy(hdr + 265, "root", (size_t)4);
+	memcpy(hdr + 297, "root", (size_t)4);
+
+	memset(hdr + 148, ' ', (size_t)8);
+	for (sum = 0, i = 0; i < 512; i++)
+		sum += hdr[i];
+	snprintf((char *)hdr + 148, (size_t)8, "%06o", (unsigned int)sum);
+	return (0);
+}
+
+/* Add a file (or a directory, if data is NULL) to the archive. */
+static int tar_add(gzFile gz, const char *name, const char *data, time_t mtime)
+{
+	unsigned char hdr[512];
+	size_t len, pad;
+
+	len = data == NULL ? 0 : strlen(data);
+	if (tar_header(hdr, name, data == NULL ? '5' : '0', len, mtime) == -1 ||
+	    gzwrite(gz, hdr, (unsigned int)sizeof(hdr)) != (int)sizeof(hdr))
+		return (-1);
+	if (len == 0)
+		return (0);
+
+	memset(hdr, '\0', sizeof(hdr));
+	pad = (512 - len % 512) % 512;
+	if (gzwrite(gz, data, (unsigned int)len) != (int)len ||
+	    (pad > 0 && gzwrite(gz, hdr, (unsigned int)pad) != (int)pad))
+		return (-1);
+	return (0);
+}
+
+/* Whether the entry ("<pkgname>-<pkgver>-<pkgrel>/...") of the
+   repository database belongs to one of the packages. A package
+   name may have dashes, but a version can't. */
+static int entry_replaced(const char *entry, const struct repo_pkg *pkgs,
+			  size_t n)
+{
+	const char *p, *end;
+	size_t i, len, ndash;
+
+	end = entry + strcspn(entry, "/");
+	for (i = 0; i < n; i++) {
+		len = strlen(pkgs[i].name);
+		if ((size_t)(end - entry) <= len ||
+		    strncmp(entry, pkgs[i].name, len) != 0 || entry[len] != '-')
+			continue;
+
+		ndash = 0;
+		for (p = entry + len + 1; p < end; p++)
+			if (*p == '-')
+				ndash++;
+		if (ndash == 1)
+			return (1);
+	}
+
+	return (0);
+}
+
+/* Write the database (path) again, with the entries of the old one
+   (except the replaced packages), which are copied as they are,
+   and then the entries of the packages. Returns -1, on errors. */
+static int update_repo_db(const char *path, const struct repo_pkg *pkgs,
+			  size_t n, int with_files)
+{
+	gzFile in, out;
+	unsigned char hdr[512];
+	char num[13], fname[257], *tmp, *ext, *v;
+	struct curl_memory held, data;
+	unsigned long long sz, padded;
+	size_t i, sz2;
+	time_t now;
+	int ret, keep;
+
+	sz2 = strlen(path) + sizeof(".tmp");
+	tmp = calloc(sz2, sizeof(char));
+	if (tmp == NULL)
+		err(EXIT_FAILURE, "calloc()");
+	snprintf(tmp, sz2, "%s.tmp", path);
+
+	out = gzopen(tmp, "wb");
+	if (out == NULL) {
+		free(tmp);
+		return (-1);
+	}
+
+	ret = 0;
+	memset(&held, '\0', sizeof(struct curl_memory));
+	memset(&data, '\0', sizeof(struct curl_memory));
+	ext = NULL;
+	in = gzopen(path, "rb");
+	while (in != NULL &&
+	       gzread(in, hdr, (unsigned int)sizeof(hdr)) == (int)sizeof(hdr)) {
+		if (hdr[0] == '\0')
+			break;
+
+		memcpy(num, hdr + 124, (size_t)12);
+		num[12] = '\0';
+		sz = strtoull(num, (char **)NULL, 8);
+		padded = (sz + 511) & ~(unsigned long long)511;
+
+		/* The header and the data of the entry. */
+		if (sizeof(hdr) + padded + 1 > data.bt) {
+			data.bt = sizeof(hdr) + (size_t)padded + 1;
+			v = realloc(data.resp, data.bt);
+			if (v == NULL)
+				err(EXIT_FAILURE, "realloc()");
+			data.resp = v;
+		}
+		memcpy(data.resp, hdr, sizeof(hdr));
+		data.nsz = sizeof(hdr);
+		if (padded > 0 &&
+		    gzread(in, data.resp + data.nsz,
+			   (unsigned int)padded) != (int)padded) {
+			ret = -1;
+			break;
+		}
+		data.nsz += padded;
+		data.resp[data.nsz] = '\0';
+
+		/* Long names (GNU or pax) are held with their entry. */
+		if (hdr[156] == 'L' || hdr[156] == 'x' || hdr[156] == 'g') {
+			if (hdr[156] == 'L') {
+				free(ext);
+				ext = strndup(data.resp + 512, (size_t)sz);
+			} else if (hdr[156] == 'x' &&
+				   (v = strstr(data.resp + 512, " path=")) != NULL) {
+				free(ext);
+				v += 6;
+				ext = strndup(v, strcspn(v, "\n"));
+			}
+			curl_write_cb(data.resp, (size_t)1, data.nsz, &held);
+			continue;
+		}
+
+		if (memcmp(hdr + 257, "ustar", (size_t)5) == 0 &&
+		    hdr[345] != '\0')
+			snprintf(fname, sizeof(fname), "%.155s/%.100s",
+				 (char *)hdr + 345, (char *)hdr);
+		else
+			snprintf(fname, sizeof(fname), "%.100s", (char *)hdr);
+
+		keep = entry_replaced(ext != NULL ? ext : fname, pkgs, n) == 0;
+		if (keep && ((held.nsz > 0 &&
+			      gzwrite(out, held.resp, (unsigned int)held.nsz) !=
+			      (int)held.nsz) ||
+			     gzwrite(out, data.resp, (unsigned int)data.nsz) !=
+			     (int)data.nsz)) {
+			ret = -1;
+			break;
+		}
+
+		held.nsz = 0;
+		free(ext);
+		ext = NULL;
+	}
+	if (in != NULL)
+		gzclose(in);
+
+	/* New entries, and the end of the archive. */
+	now = time(NULL);
+	for (i = 0; i < n && ret == 0; i++) {
+		data.nsz = 0;
+		mem_append(&data, "%s/", pkgs[i].dir);
+		ret = tar_add(out, data.resp, NULL, now);
+		data.nsz = 0;
+		mem_append(&data, "%s/desc", pkgs[i].dir);
+		if (ret == 0)
+			ret = tar_add(out, data.resp, pkgs[i].desc, now);
+		data.nsz = 0;
+		mem_append(&data, "%s/files", pkgs[i].dir);
+		if (ret == 0 && with_files)
+			ret = tar_add(out, data.resp, pkgs[i].files, now);
+	}
+	memset(hdr, '\0', sizeof(hdr));
+	for (i = 0; i < 2 && ret == 0; i++)
+		if (gzwrite(out, hdr, (unsigned int)sizeof(hdr)) != (int)sizeof(hdr))
+			ret = -1;
+
+	if (gzclose(out) != Z_OK)
+		ret = -1;
+	if (ret == 0 && rename(tmp, path) == -1)
+		ret = -1;
+	if (ret == -1)
+		unlink(tmp);
+
+	free(ext);
+	free(held.resp);
+	free(data.resp);
+	free(tmp);
+	return (ret);
+}
+
+/* Copy the file to dir, unless it's there already. */
+static int copy_to_dir(const char *path, const char *dir, const char *file)
+{
+	struct curl_memory dst, tmp;
+	char buf[65536];
+	ssize_t n, w, off;
+	int in, out, ret;
+
+	memset(&dst, '\0', sizeof(struct curl_memory));
+	memset(&tmp, '\0', sizeof(struct curl_memory));
+	mem_append(&dst, "%s/%s", dir, file);
+	mem_append(&tmp, "%s.tmp", dst.resp);
+
+	ret = -1;
+	in = out = -1;
+	if (strcmp(dst.resp, path) == 0) {
+		ret = 0;
+		goto out;
+	}
+
+	in = open(path, O_RDONLY | O_CLOEXEC);
+	if (in == -1)
+		goto out;
+	out = open(tmp.resp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (out == -1)
+		goto out;
+
+	ret = 0;
+	while (ret == 0 && (n = read(in, buf, sizeof(buf))) != 0) {
+		if (n == -1) {
+			if (errno != EINTR)
+				ret = -1;
+			continue;
+		}
+		for (off = 0; ret == 0 && off < n; off += w) {
+			w = write(out, buf + off, (size_t)(n - off));
+			if (w == -1) {
+				w = 0;
+				if (errno != EINTR)
+					ret = -1;
+			}
+		}
+	}
+
+	if (close(out) == -1)
+		ret = -1;
+	out = -1;
+	if (ret == 0 && rename(tmp.resp, dst.resp) == -1)
+		ret = -1;
+	if (ret == -1)
+		unlink(tmp.resp);
+
+out:
+	if (in != -1)
+		close(in);
+	if (out != -1)
+		close(out);
+	free(dst.resp);
+	free(tmp.resp);
+	return (ret);
+}
+
+/* Free the packages, which were added to the repository. */
+static void free_repo_pkgs(struct repo_pkg *pkgs, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		free(pkgs[i].name);
+		free(pkgs[i].dir);
+		free(pkgs[i].desc);
+		free(pkgs[i].files);
+	}
+	free(pkgs);
+}
+
+/* Publish the built package files (one per line) in the local
+   repository, whose database is db ("<dir>/<name>.db.tar.gz").
+   The packages are copied there, and their entries replace the
+   old ones in the .db and .files databases, which is done here,
+   instead of running repo-add. The repository is locked, while
+   it's being updated. */
+static void publish_packages(const char *db, const char *built,
+			     int enable_colors)
+{
+	struct curl_memory dir, fdb, lock, link;
+	struct repo_pkg *pkgs;
+	char *list, *path, *sv, *file;
+	const char *slash;
+	size_t n, cap, len;
+	int fd;
+
+	len = strlen(db);
+	if (len < sizeof(".db.tar.gz") ||
+	    strcmp(db + len - sizeof(".db.tar.gz") + 1, ".db.tar.gz") != 0) {
+		warnx("warning: '%s' isn't a .db.tar.gz database.", db);
+		return;
+	}
+
+	memset(&dir, '\0', sizeof(struct curl_memory));
+	memset(&fdb, '\0', sizeof(struct curl_memory));
+	memset(&lock, '\0', sizeof(struct curl_memory));
+	memset(&link, '\0', sizeof(struct curl_memory));
+	slash = strrchr(db, '/');
+	if (slash == NULL)
+		mem_append(&dir, ".");
+	else
+		mem_append(&dir, "%.*s", (int)(slash == db ? 1 : slash - db), db);
+	mem_append(&fdb, "%.*s.files.tar.gz",
+		   (int)(len - sizeof(".db.tar.gz") + 1), db);
+	mem_append(&lock, "%.*s.lck", (int)(len - sizeof(".tar.gz") + 1), db);
+
+	if (enable_colors)
+		fprintf(stdout, COLOR_BLUE":: "COLOR_WHITE
+			"Publishing to %s...\n"COLOR_END, db);
+	else
+		fprintf(stdout, ":: Publishing to %s...\n", db);
+
+	if (make_dir(dir.resp) == -1)
+		warn("mkdir(): %s", dir.resp);
+	fd = open(lock.resp, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd == -1 || flock(fd, LOCK_EX) == -1) {
+		warn("cannot lock '%s'", lock.resp);
+		goto out;
+	}
+
+	list = strdup(built);
+	if (list == NULL)
+		err(EXIT_FAILURE, "strdup()");
+
+	pkgs = NULL;
+	n = cap = 0;
+	for (path = strtok_r(list, "\n", &sv); path != NULL;
+	     path = strtok_r(NULL, "\n", &sv)) {
+		if (n == cap) {
+			cap = cap == 0 ? 8 : cap * 2;
+			pkgs = realloc(pkgs, cap * sizeof(struct repo_pkg));
+			if (pkgs == NULL)
+				err(EXIT_FAILURE, "realloc()");
+		}
+
+		file = strrchr(path, '/');
+		file = file == NULL ? path : file + 1;
+		if (read_repo_pkg(path, file, &pkgs[n]) == -1 ||
+		    copy_to_dir(path, dir.resp, file) == -1) {
+			warnx("warning: cannot publish '%s'.", path);
+			free(pkgs[n].name);
+			free(pkgs[n].dir);
+			free(pkgs[n].desc);
+			free(pkgs[n].files);
+			continue;
+		}
+		n++;
+	}
+
+	if (n > 0 && (update_repo_db(db, pkgs, n, 0) == -1 ||
+		      update_repo_db(fdb.resp, pkgs, n, 1) == -1))
+		warnx("warning: cannot update '%s'.", db);
+
+	/* pacman looks for "<name>.db" and "<name>.files". */
+	mem_append(&link, "%.*s", (int)(len - sizeof(".tar.gz") + 1), db);
+	if (symlink(db + (slash == NULL ? 0 : slash - db + 1), link.resp) == -1 &&
+	    errno != EEXIST)
+		warn("symlink(): %s", link.resp);
+	link.nsz = 0;
+	mem_append(&link, "%.*s", (int)(fdb.nsz - sizeof(".tar.gz") + 1),
+		   fdb.resp);
+	slash = strrchr(fdb.resp, '/');
+	if (symlink(slash == NULL ? fdb.resp : slash + 1, link.resp) == -1 &&
+	    errno != EEXIST)
+		warn("symlink(): %s", link.resp);
+
+	free_repo_pkgs(pkgs, n);
+	free(list);
+
+out:
+	if (fd != -1)
+		close(fd);
+	free(dir.resp);
+	free(fdb.resp);
+	free(lock.resp);
+	free(link.resp);
+}
+
+/* Whether the package file (path) is one of the packages (comma
+   separated), which are named "pkgname-pkgver-pkgrel-arch.pkg.tar.*".
+   Debug packages (pkgname-debug) aren't. */
+static int is_package_file(const char *path, const char *pkgs)
+{
+	const char *file, *p, *q;
+	size_t len, ndash;
+
+	file = strrchr(path, '/');
+	file = file == NULL ? path : file + 1;
+
+	for (p = pkgs; *p != '\0'; p += len + (p[len] == ',')) {
+		len = strcspn(p, ",");
+		if (strncmp(file, p, len) != 0 || file[len] != '-')
+			continue;
+
+		ndash = 0;
+		for (q = file + len + 1; *q != '\0'; q++)
+			if (*q == '-')
+				ndash++;
+		if (ndash == 2)
+			return (1);
+	}
+
+	return (0);
+}
+
+/* Append the package files of the selected packages (comma separated),
+   which makepkg built in dir, to built (one per line). */
+static void collect_built_packages(const char *dir, const char *pkgs,
+				   struct curl_memory *built)
+{
+	char *out, *line, *sv, *path;
+	size_t sz;
+	char *argv[] = { DEFAULT_MAKEPKG_PATH, "--packagelist", NULL };
+
+	out = NULL;
+	if (run_program(dir, argv, NULL, 0, &out) != 0 || out == NULL) {
+		warnx("warning: cannot list the packages of '%s'.", dir);
+		free(out);
+		return;
+	}
+
+	for (line = strtok_r(out, "\n", &sv); line != NULL;
+	     line = strtok_r(NULL, "\n", &sv)) {
+		if (is_package_file(line, pkgs) == 0)
+			continue;
+
+		/* Relative to dir, if PKGDEST isn't set. */
+		if (*line == '/') {
+			path = strdup(line);
+			if (path == NULL)
+				err(EXIT_FAILURE, "strdup()");
+		} else {
+			sz = strlen(dir) + strlen(line) + 2;
+			path = calloc(sz, sizeof(char));
+			if (path == NULL)
+				err(EXIT_FAILURE, "calloc()");
+			snprintf(path, sz, "%s/%s", dir, line);
+		}
+
+		if (access(path, F_OK) == 0)
+			mem_append(built, "%s\n", path);
+		else
+			warnx("warning: '%s' wasn't built.", path);
+		free(path);
+	}
+
+	free(out);
+}
+
+/* Run pacman with the options, and the arguments (separated by
+   any of sep). It's run with sudo, unless we're already root. */
+static void run_pacman(const char *const opts[], char *args, const char *sep)
+{
+	char **argv, *p, *sv;
+	size_t n;
+	pid_t pid;
+
+	argv = calloc(strlen(args) / 2 + 8, sizeof(char *));
+	if (argv == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	n = 0;
+	if (geteuid() != 0)
+		argv[n++] = DEFAULT_SUDO_PATH;
+	argv[n++] = DEFAULT_PACMAN_PATH;
+	for (; *opts != NULL; opts++)
+		argv[n++] = (char *)*opts;
+	for (p = strtok_r(args, sep, &sv); p != NULL;
+	     p = strtok_r(NULL, sep, &sv))
+		argv[n++] = p;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid == (pid_t)-1)
+	        err(EXIT_FAILURE, "fork()");
+
+	if (pid == (pid_t)0) {
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	/* Wait till it's done. */
+        while (waitpid(pid, NULL, 0) < 0)
+		;
+	free(argv);
+}
+
+/* Install packages (space separated) from the sync databases. */
+static void install_from_repos(char *names, int enable_colors)
+{
+	static const char *const opts[] = { "-S", "--needed", NULL };
+
+	if (enable_colors)
+		fputs(COLOR_BLUE":: "COLOR_WHITE
+		      "Installing from the sync repositories...\n"COLOR_END,
+		      stdout);
+	else
+		fputs(":: Installing from the sync repositories...\n", stdout);
+
+	run_pacman(opts, names, " ");
+}
+
+/* Install the built package files (one per line), in a single
+   transaction, so pacman's hooks only run once. */
+static void install_built_packages(struct curl_memory *built,
+				   int enable_colors)
+{
+	static const char *const opts[] = { "-U", NULL };
+
+	if (built->nsz == 0)
+		return;
+
+	if (enable_colors)
+		fputs(COLOR_BLUE":: "COLOR_WHITE
+		      "Installing the built packages...\n"COLOR_END, stdout);
+	else
+		fputs(":: Installing the built packages...\n", stdout);
+
+	run_pacman(opts, built->resp, "\n");
+	built->nsz = 0;
+	if (built->resp != NULL)
+		built->resp[0] = '\0';
+}
+
+/* Run makepkg, and install the packages (comma separated) of it.
+   The whole base is built, and only the selected packages' files
+   are installed, with a single "pacman -U". If built isn't NULL,
+   they're only built, and their files are appended there, to be
+   installed later. With a local repository, they're published
+   there too. */
+static void makepkg_and_install(const char *dir, const char *pkgs,
+				struct curl_memory *built,
+				const struct arg_opts *opts)
+{
+	pid_t pid;
+	int ret, status;
+	struct build_cache bc;
+	struct curl_memory files;
+
+	/* Check whether you're using Arch GNU/Linux or not. */
+	if (likely_running_arch_gnu() == 0)
+		errx(EXIT_FAILURE,
+		     "You are not running Arch GNU/Linux. "
+		     "So I cannot run 'makepkg' here.");
+
+	ret = access(DEFAULT_MAKEPKG_PATH, F_OK);
+	if (ret == -1) {
+		if (errno == ENOENT)
+			errx(EXIT_FAILURE,
+			     "access(): 'makepkg' is not installed.");
+		else
+			err(EXIT_FAILURE, "access()");
+	}
+
+	/* Compiler cache for this package base. */
+	memset(&bc, '\0', sizeof(struct build_cache));
+	if (opts->is_ccache)
+		setup_build_cache(dir, &bc);
+
+	fflush(stdout);
+	pid = fork();
+	if (pid == (pid_t)-1)
+	        err(EXIT_FAILURE, "fork()");
+
+	if (pid == (pid_t)0) {
+	        if (chdir(dir) == -1)
+			err(EXIT_FAILURE, "chdir()");
+
+		apply_build_cache(&bc);
+		/* Split packages are all built, the selected ones
+		   are picked from --packagelist afterwards. */
+		ret = execl(DEFAULT_MAKEPKG_PATH, "makepkg", "-s",
+			    (char *)NULL);
+		if (ret == -1)
+			_exit(127);
+	}
+
+	/* Wait till it's done. */
+        while (waitpid(pid, &status, 0) < 0)
+		;
+
+	report_build_cache(dir, &bc, opts->is_colors);
+
+	if (WIFEXITED(status) == 0 || WEXITSTATUS(status) != 0) {
+		warnx("warning: cannot build '%s'.", dir);
+		return;
+	}
+
+	memset(&files, '\0', sizeof(struct curl_memory));
+	collect_built_packages(dir, pkgs, &files);
+	if (files.nsz > 0) {
+		if (opts->local_repo != NULL)
+			publish_packages(opts->local_repo, files.resp,
+					 opts->is_colors);
+		if (built != NULL)
+			mem_append(built, "%s", files.resp);
+		else
+			install_built_packages(&files, opts->is_colors);
+	}
+	free(files.resp);
+}
+
+/* Do curl request to search for a specific package. */
+static MAIN_ONLY char *search_for_pkg(const char *pkg)
+{
+	char *fmt, *resp;
+
+	fmt = format_simple_url(pkg);
+	resp = budgeted_request(fmt);
+	free(fmt);
+
+	/* Return the response buffer. */
+	return (resp);
+}
+
+/* Keep the error, once the download is done. */
+static void download_done(struct aurpkg_ctx *ctx,
+			  const struct aurpkg_result *res, void *udata)
+{
+	(void)ctx;
+	*(enum aurpkg_error *)udata = res->error;
+}
+
+/* Download the snapshot of pkgbase to a file. The library tries
+   the other endpoints, if it fails. */
+static void download_snapshot(const char *name, const char *pkgbase)
+{
+	enum aurpkg_error e;
+	int id;
+
+	e = AURPKG_ENET;
+	id = aurpkg_download(aur_context(), pkgbase, name, download_done, &e);
+	if (id < 0)
+		errx(EXIT_FAILURE, "aurpkg_download(): %s",
+		     aurpkg_strerror((enum aurpkg_error)-id));
+
+	aurpkg_run(aur);
+	if (e != AURPKG_OK)
+		errx(EXIT_FAILURE, "error: cannot download '%s': %s",
+		     name, aurpkg_strerror(e));
+}
+
+/* Quicksort comparision function. */
+static int sort_compare(const void *a, const void *b)
+{
+	const JSON_Object *sa, *sb;
+        uint64_t vsa, vsb;
+
+	sa = *(const JSON_Object **)a;
+	sb = *(const JSON_Object **)b;
+
+	/* Number of votes. */
+	vsa = (uint64_t)json_object_get_number(sa, "NumVotes");
+	vsb = (uint64_t)json_object_get_number(sb, "NumVotes");
+
+	/* TODO: See Ant's answer. */
+	return ((vsa > vsb) - (vsa < vsb));
+}
+
+/* Last date of a listing, and the range of time (UTC) its local
+   day covers. Rows of the same day use it as it is, without calling
+   localtime_r() or formatting it again. The range is the offset of
+   that day, not a single one, as zones have moved by a whole day. */
+struct date_cache {
+	time_t lo;
+	time_t hi;
+	char str[16];
+};
+
+static struct date_cache date_cache;
+
+/* Append the local date of t, as YYYY-MM-DD. */
+static void mem_put_date(struct curl_memory *cm, time_t t)
+{
+	struct tm tm;
+
+	if (date_cache.str[0] == '\0' ||
+	    t < date_cache.lo + RENDER_DST_WINDOW ||
+	    t >= date_cache.hi - RENDER_DST_WINDOW) {
+		if (localtime_r(&t, &tm) == NULL)
+			err(EXIT_FAILURE, "localtime_r()");
+		strftime(date_cache.str, sizeof(date_cache.str), "%Y-%m-%d", &tm);
+		date_cache.lo = t - (tm.tm_hour * 3600 + tm.tm_min * 60 +
+				     tm.tm_sec);
+		date_cache.hi = date_cache.lo + 86400;
+	}
+
+	mem_puts(cm, date_cache.str);
+}
+
+/* Safely use strtoul (unsigned long). */
+static uintptr_t safe_atoul(const char *str)
+{
+	uintptr_t ret;
+
+	ret = strtoul(str, (char **)NULL, 10);
+	return (ret);
+}
+
+/* Copy a string into the store's arena, and return its offset. */
+static uint32_t store_add_string(struct aur_store *st, const char *str)
+{
+	size_t len, cap;
+	char *rp;
+
+	if (str == NULL)
+		return (STORE_NONE);
+
+	len = strlen(str) + (size_t)1;
+	if (st->arena_sz + len > st->arena_cap) {
+		cap = st->arena_cap == 0 ? (size_t)4096 : st->arena_cap;
+		while (st->arena_sz + len > cap)
+			cap *= 2;
+
+		rp = realloc(st->arena, cap);
+		if (rp == NULL)
+			err(EXIT_FAILURE, "realloc()");
+		st->arena = rp;
+		st->arena_cap = cap;
+	}
+
+	if (st->arena_sz + len > (size_t)STORE_NONE)
+		errx(EXIT_FAILURE, "error: too many search results.");
+
+	memcpy(st->arena + st->arena_sz, str, len);
+	st->arena_sz += len;
+	return ((uint32_t)(st->arena_sz - len));
+}
+
+/* Same as store_add_string(), but if the string was added
+   before, return the previous offset instead of copying it. */
+static uint32_t store_intern(struct aur_store *st, const char *str)
+{
+	size_t i, mask;
+	uint32_t off;
+
+	if (str == NULL)
+		return (STORE_NONE);
+
+	/* Linear probing, the table has enough space for every
+	   result, so it's never more than half full. */
+	mask = st->itab_cap - 1;
+	i = (size_t)fnv1a_hash(str) & mask;
+	while (st->itab[i] != STORE_NONE) {
+		if (strcmp(st->arena + st->itab[i], str) == 0)
+			return (st->itab[i]);
+		i = (i + 1) & mask;
+	}
+
+	off = store_add_string(st, str);
+	st->itab[i] = off;
+	return (off);
+}
+
+/* Get the string from the offset. Returns NULL for STORE_NONE. */
+static const char *store_str(const struct aur_store *st, uint32_t off)
+{
+	if (off == STORE_NONE)
+		return (NULL);
+	return (st->arena + off);
+}
+
+/* Allocate the columns of the result store, for count results. */
+static void store_alloc(struct aur_store *st, size_t count)
+{
+	st->count = count;
+	st->numvotes = calloc(count, sizeof(uint32_t));
+	st->popularity = calloc(count, sizeof(double));
+	st->outdated = calloc(count, sizeof(time_t));
+	st->last_modified = calloc(count, sizeof(time_t));
+	st->name = calloc(count, sizeof(uint32_t));
+	st->description = calloc(count, sizeof(uint32_t));
+	st->version = calloc(count, sizeof(uint32_t));
+	st->maintainer = calloc(count, sizeof(uint32_t));
+	st->url_path = calloc(count, sizeof(uint32_t));
+	st->url_base = calloc(count, sizeof(uint32_t));
+	if (st->numvotes == NULL || st->popularity == NULL ||
+	    st->outdated == NULL || st->last_modified == NULL ||
+	    st->name == NULL || st->description == NULL ||
+	    st->version == NULL || st->maintainer == NULL ||
+	    st->url_path == NULL || st->url_base == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	/* Power of two, and at least twice the number of results,
+	   as there are two interned strings per result. */
+	st->itab_cap = (size_t)16;
+	while (st->itab_cap < count * 4)
+		st->itab_cap *= 2;
+	st->itab = malloc(st->itab_cap * sizeof(uint32_t));
+	if (st->itab == NULL)
+		err(EXIT_FAILURE, "malloc()");
+	memset(st->itab, 0xff, st->itab_cap * sizeof(uint32_t));
+}
+
+/* Free the result store. */
+static void free_search_results(struct aur_store *st)
+{
+	free(st->numvotes);
+	free(st->popularity);
+	free(st->outdated);
+	free(st->last_modified);
+	free(st->name);
+	free(st->description);
+	free(st->version);
+	free(st->maintainer);
+	free(st->url_path);
+	free(st->url_base);
+	free(st->arena);
+	free(st->itab);
+	memset(st, '\0', sizeof(struct aur_store));
+}
+
+/* Sort the results and add them to the result store.
+   Returns the number of results. */
+static size_t collect_search_results(JSON_Object *jobj,
+				     struct aur_store *st)
+{
+	size_t i, lcount;
+	JSON_Array *jarr;
+	JSON_Object **jobjs;
+	const char *s;
+
+	memset(st, '\0', sizeof(struct aur_store));
+	jarr = json_object_get_array(jobj, "results");
+	lcount = (size_t)json_object_get_number(jobj, "resultcount");
+	/* Don't trust resultcount more than the array itself. */
+	if (lcount > json_array_get_count(jarr))
+		lcount = json_array_get_count(jarr);
+
+	if (lcount == (size_t)0)
+		return (0);
+
+	/* JSON objects structure. */
+	jobjs = calloc(lcount, sizeof(JSON_Object *));
+	if (jobjs == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	store_alloc(st, lcount);
+
+	/* Set the each object to jobjs. */
+	for (i = 0; i < lcount; i++)
+		jobjs[i] = json_array_get_object(jarr, i);
+
+	/* Sort the JSON structure, according whoever got the most
+	   votes, by swapping the pointers. */
+        qsort(jobjs, lcount, sizeof(JSON_Object *), sort_compare);
+
+	/* Now sorted, so let's add each objects. */
+	for (i = 0; i < lcount; i++) {
+		st->name[i] = store_add_string(st, json_object_get_string(jobjs[i], "Name"));
+		s = json_object_get_string(jobjs[i], "Description");
+		st->description[i] = store_add_string(st, s != NULL ?
+						      s : "no description was specified");
+		s = json_object_get_string(jobjs[i], "Version");
+		st->version[i] = store_add_string(st, s != NULL ? s : "unknown");
+		st->numvotes[i] = (uint32_t)json_object_get_number(jobjs[i], "NumVotes");
+		st->popularity[i] = json_object_get_number(jobjs[i], "Popularity");
+		st->outdated[i] = (time_t)json_object_get_number(jobjs[i], "OutOfDate");
+		st->last_modified[i] = (time_t)json_object_get_number(jobjs[i], "LastModified");
+		/* If there are no maintainer, then the package is considerd orphaned. */
+		st->maintainer[i] = store_intern(st, json_object_get_string(jobjs[i], "Maintainer"));
+
+		/* Apparently, package path may not be correct when using URLPath.
+		   Either because it's outdated or not updated in the AUR repository.
+		   To "fix" that use "PackageBase" as the archive name. */
+		st->url_path[i] = store_add_string(st, json_object_get_string(jobjs[i], "URLPath"));
+		st->url_base[i] = store_intern(st, json_object_get_string(jobjs[i], "PackageBase"));
+	}
+
+	free(jobjs);
+	return (lcount);
+}
+
+/* Background snapshot downloads, while the user is choosing. */
+struct prefetch {
+	pid_t pid;
+	char *dir;
+	const struct aur_store *st;
+	size_t first;
+};
+
+/* Running prefetch, to be cleaned up if we exit on an error. */
+static struct prefetch *prefetch_running;
+
+/* Path of the prefetched snapshot of pkgbase. The caller frees it. */
+static char *prefetch_path(const struct prefetch *pf, const char *pbase,
+			   const char *suffix)
+{
+	char *p;
+	size_t sz;
+
+	sz = strlen(pf->dir) + strlen(pbase) + strlen(suffix) +
+		sizeof("/.tar.gz");
+	p = calloc(sz, sizeof(char));
+	if (p == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	snprintf(p, sz, "%s/%s.tar.gz%s", pf->dir, pbase, suffix);
+	return (p);
+}
+
+/* Download snapshots of the top results (the ones with the most
+   votes, printed last) in a child process. Bandwidth and disk usage
+   are capped, and any failure is silently ignored, as the selected
+   packages will be downloaded as usual if they aren't here. */
+static void start_prefetch(const struct aur_store *st, size_t n,
+			   struct prefetch *pf)
+{
+	struct aurpkg_ctx *ctx;
+	struct stat sb;
+	enum aurpkg_error e;
+	char *part, *done;
+	const char *pbase;
+	size_t i, usz;
+	long left;
+	int fd;
+
+	memset(pf, '\0', sizeof(struct prefetch));
+	pf->pid = (pid_t)-1;
+	pf->st = st;
+	if (n == 0)
+		return;
+
+	pf->first = n >= st->count ? 0 : st->count - n;
+	usz = sizeof(".aurpkg-prefetch.") + 20;
+	pf->dir = calloc(usz, sizeof(char));
+	if (pf->dir == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	snprintf(pf->dir, usz, ".aurpkg-prefetch.%ld", (long)getpid());
+	if (mkdir(pf->dir, 0755) == -1) {
+		warn("mkdir()");
+		free(pf->dir);
+		pf->dir = NULL;
+		return;
+	}
+
+	/* So the child doesn't probe the endpoints again. */
+	if (aur != NULL)
+		aurpkg_save_state(aur);
+
+	/* Or the child would write the parent's buffered output too. */
+	fflush(stdout);
+	pf->pid = fork();
+	if (pf->pid == (pid_t)-1) {
+		warn("fork()");
+		prefetch_running = pf;
+		return;
+	}
+
+	if (pf->pid != (pid_t)0) {
+		prefetch_running = pf;
+		return;
+	}
+
+	/* It leaves with _exit(), or with err() and errx(), which run
+	   the parent's atexit() handlers. They do nothing here. */
+	prefetch_child = 1;
+
+	/* Don't mess with the prompt. */
+	fd = open("/dev/null", O_WRONLY);
+	if (fd != -1) {
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		close(fd);
+	}
+
+	/* Connections of the parent's context aren't ours. */
+	ctx = new_aur_context();
+	left = (long)PREFETCH_MAX_DISK;
+	for (i = st->count; i > pf->first && left > 0; i--) {
+		pbase = store_str(st, st->url_base[i - 1]);
+		if (pbase == NULL || strchr(pbase, '/') != NULL)
+			continue;
+
+		done = prefetch_path(pf, pbase, "");
+		/* Split packages share the same snapshot. */
+		if (access(done, F_OK) == 0) {
+			free(done);
+			continue;
+		}
+
+		part = prefetch_path(pf, pbase, ".part");
+		aurpkg_set_limits(ctx, (long)PREFETCH_MAX_RATE, left);
+		e = AURPKG_ENET;
+		if (aurpkg_download(ctx, pbase, part, download_done, &e) > 0)
+			aurpkg_run(ctx);
+
+		if (stat(part, &sb) == 0)
+			left -= (long)sb.st_size;
+		if (e == AURPKG_OK && left >= 0)
+			rename(part, done);
+		else
+			unlink(part);
+
+		free(part);
+		free(done);
+	}
+
+	aurpkg_free(ctx);
+	_exit(EXIT_SUCCESS);
+}
+
+/* Stop the prefetch, whatever it's downloading right now. */
+static void stop_prefetch(struct prefetch *pf)
+{
+	if (pf->pid <= (pid_t)0)
+		return;
+
+	kill(pf->pid, SIGTERM);
+	while (waitpid(pf->pid, NULL, 0) < 0 && errno == EINTR)
+		;
+	pf->pid = (pid_t)-1;
+}
+
+/* If the snapshot of pbase was prefetched, move it to dest.
+   Returns 1 if it was, otherwise 0. */
+static int take_prefetched(const struct prefetch *pf, const char *pbase,
+			   const char *dest)
+{
+	char *p;
+	int ret;
+
+	if (pf->dir == NULL)
+		return (0);
+
+	p = prefetch_path(pf, pbase, "");
+	ret = rename(p, dest) == 0;
+	free(p);
+	return (ret);
+}
+
+/* Remove snapshots of the packages that weren't selected. */
+static void cleanup_prefetch(struct prefetch *pf)
+{
+	const char *pbase;
+	char *p;
+	size_t i;
+
+	stop_prefetch(pf);
+	if (pf->dir == NULL)
+		return;
+
+	for (i = pf->first; i < pf->st->count; i++) {
+		pbase = store_str(pf->st, pf->st->url_base[i]);
+		if (pbase == NULL)
+			continue;
+
+		p = prefetch_path(pf, pbase, "");
+		unlink(p);
+		free(p);
+		p = prefetch_path(pf, pbase, ".part");
+		unlink(p);
+		free(p);
+	}
+
+	if (rmdir(pf->dir) == -1)
+		warn("rmdir()");
+	free(pf->dir);
+	pf->dir = NULL;
+	prefetch_running = NULL;
+}
+
+/* atexit() handler, err() and errx() don't return. */
+static void cleanup_prefetch_atexit(void)
+{
+	if (prefetch_running != NULL && prefetch_child == 0)
+		cleanup_prefetch(prefetch_running);
+}
+
+/* A package from a sync database, all fields point into
+   its "desc" file. Provides are separated by newlines. */
+struct sync_pkg {
+	const char *repo;
+	char *name;
+	char *version;
+	char *provides;
+	char *csize;
+};
+
+/* Called for every package of a sync database. */
+typedef void (*sync_pkg_cb)(const struct sync_pkg *, void *);
+
+/* Parse a "desc" file of a sync database, in place. Each
+   field is "%KEY%" line, followed by values until an empty line. */
+static void parse_sync_desc(char *desc, struct sync_pkg *sp)
+{
+	char *p, *key, *end;
+	size_t len;
+
+	sp->name = sp->version = sp->provides = sp->csize = NULL;
+	p = desc;
+	while (*p != '\0') {
+		if (*p != '%') {
+			p = strchr(p, '\n');
+			if (p == NULL)
+				break;
+			p++;
+			continue;
+		}
+
+		key = p;
+		p = strchr(p, '\n');
+		if (p == NULL)
+			break;
+		*p++ = '\0';
+
+		end = strstr(p, "\n\n");
+		if (end != NULL)
+			*end = '\0';
+
+		/* Last field may end with a single newline. */
+		len = strlen(p);
+		if (len > 0 && p[len - 1] == '\n')
+			p[len - 1] = '\0';
+
+		if (strcmp(key, "%NAME%") == 0)
+			sp->name = p;
+		else if (strcmp(key, "%VERSION%") == 0)
+			sp->version = p;
+		else if (strcmp(key, "%PROVIDES%") == 0)
+			sp->provides = p;
+		else if (strcmp(key, "%CSIZE%") == 0)
+			sp->csize = p;
+
+		if (end == NULL)
+			break;
+		p = end + 2;
+	}
+}
+
+/* Read a sync database (a gzipped tarball), and call cb for each
+   "desc" file in it. Returns -1, if the database can't be opened. */
+static int read_sync_db(const char *path, const char *repo,
+			sync_pkg_cb cb, void *ctx)
+{
+	gzFile gz;
+	unsigned char hdr[512];
+	char num[13], fname[257];
+	char *buf, *longname, *name, *rp, *v;
+	unsigned long long sz, padded;
+	size_t len, bufsz;
+	struct sync_pkg sp;
+
+	gz = gzopen(path, "rb");
+	if (gz == NULL)
+		return (-1);
+
+	buf = NULL;
+	bufsz = 0;
+	longname = NULL;
+	while (gzread(gz, hdr, (unsigned int)sizeof(hdr)) == (int)sizeof(hdr)) {
+		/* An empty block marks the end of the archive. */
+		if (hdr[0] == '\0')
+			break;
+
+		memcpy(num, hdr + 124, (size_t)12);
+		num[12] = '\0';
+		sz = strtoull(num, (char **)NULL, 8);
+		padded = (sz + 511) & ~(unsigned long long)511;
+
+		/* Regular files, named "<pkgname>-<pkgver>/desc". */
+		if (memcmp(hdr + 257, "ustar", (size_t)5) == 0 &&
+		    hdr[345] != '\0')
+			snprintf(fname, sizeof(fname), "%.155s/%.100s",
+				 (char *)hdr + 345, (char *)hdr);
+		else
+			snprintf(fname, sizeof(fname), "%.100s", (char *)hdr);
+		name = longname != NULL ? longname : fname;
+		len = strlen(name);
+
+		if (hdr[156] != 'x' && hdr[156] != 'L' &&
+		    ((hdr[156] != '0' && hdr[156] != '\0') ||
+		     len < 5 || strcmp(name + len - 5, "/desc") != 0)) {
+			if (gzseek(gz, (z_off_t)padded, SEEK_CUR) == -1)
+				break;
+			free(longname);
+			longname = NULL;
+			continue;
+		}
+
+		if (padded + 1 > bufsz) {
+			bufsz = (size_t)padded + 1;
+			rp = realloc(buf, bufsz);
+			if (rp == NULL)
+				err(EXIT_FAILURE, "realloc()");
+			buf = rp;
+		}
+
+		if (gzread(gz, buf, (unsigned int)padded) != (int)padded)
+			break;
+		buf[sz] = '\0';
+
+		if (hdr[156] == 'L') {
+			/* GNU long name, for the next entry. */
+			free(longname);
+			longname = strdup(buf);
+			if (longname == NULL)
+				err(EXIT_FAILURE, "strdup()");
+		} else if (hdr[156] == 'x') {
+			/* pax header, only the path matters. */
+			v = strstr(buf, " path=");
+			if (v != NULL) {
+				v += 6;
+				free(longname);
+				longname = strndup(v, strcspn(v, "\n"));
+				if (longname == NULL)
+					err(EXIT_FAILURE, "strndup()");
+			}
+		} else {
+			parse_sync_desc(buf, &sp);
+			sp.repo = repo;
+			if (sp.name != NULL && sp.version != NULL)
+				cb(&sp, ctx);
+			free(longname);
+			longname = NULL;
+		}
+	}
+
+	free(longname);
+	free(buf);
+	gzclose(gz);
+	return (0);
+}
+
+/* Sync index file header. The file is mapped with mmap() and used
+   as is, it's followed by the database stamps, hash buckets,
+   entries and finally the strings. */
+struct sidx_header {
+	char magic[8];
+	uint32_t ndbs;
+	uint32_t nentries;
+	uint32_t nbuckets;
+	uint32_t strings_sz;
+};
+
+/* A sync database the index was built from, with its mtime. */
+struct sidx_db {
+	uint32_t name;
+	uint32_t pad;
+	int64_t mtime;
+};
+
+/* A package name, or something provided by a package. Only
+   names have the (compressed) package size. */
+struct sidx_entry {
+	uint32_t key;
+	uint32_t pkgname;
+	uint32_t repo;
+	uint32_t version;
+	uint32_t next;
+	uint32_t is_name;
+	uint64_t csize;
+};
+
+/* Mapped (or built in memory) sync index. */
+struct sync_index {
+	void *map;
+	size_t size;
+	int mapped;
+	const struct sidx_header *hdr;
+	const struct sidx_db *dbs;
+	const uint32_t *buckets;
+	const struct sidx_entry *entries;
+	const char *strings;
+};
+
+/* Sync index, while it's being built. */
+struct sidx_builder {
+	struct sidx_entry *entries;
+	size_t nentries;
+	size_t cap;
+	struct curl_memory strings;
+};
+
+/* Add a string to the index being built, and return its offset. */
+static uint32_t sidx_add_string(struct sidx_builder *b, const char *str)
+{
+	uint32_t off;
+
+	off = (uint32_t)b->strings.nsz;
+	mem_append(&b->strings, "%s", str);
+	/* Keep the null terminator. */
+	b->strings.nsz++;
+	return (off);
+}
+
+/* Add an entry to the index being built. */
+static void sidx_add_entry(struct sidx_builder *b, const char *key,
+			   uint32_t pkgname, uint32_t repo,
+			   const char *version, int is_name, uint64_t csize)
+{
+	struct sidx_entry *rp;
+
+	if (b->nentries == b->cap) {
+		b->cap = b->cap == 0 ? (size_t)4096 : b->cap * 2;
+		rp = realloc(b->entries, b->cap * sizeof(struct sidx_entry));
+		if (rp == NULL)
+			err(EXIT_FAILURE, "realloc()");
+		b->entries = rp;
+	}
+
+	b->entries[b->nentries].key = sidx_add_string(b, key);
+	b->entries[b->nentries].pkgname = pkgname;
+	b->entries[b->nentries].repo = repo;
+	b->entries[b->nentries].version = sidx_add_string(b, version);
+	b->entries[b->nentries].is_name = (uint32_t)is_name;
+	b->entries[b->nentries].csize = csize;
+	b->nentries++;
+}
+
+/* Add a sync database package, its name and all of its provides. */
+static void sidx_add_pkg(const struct sync_pkg *sp, void *ctx)
+{
+	struct sidx_builder *b;
+	uint32_t name, repo;
+	char *p, *q, *sv;
+
+	b = (struct sidx_builder *)ctx;
+	name = sidx_add_string(b, sp->name);
+	repo = sidx_add_string(b, sp->repo);
+	sidx_add_entry(b, sp->name, name, repo, sp->version, 1,
+		       sp->csize != NULL ?
+		       (uint64_t)strtoull(sp->csize, (char **)NULL, 10) : 0);
+
+	if (sp->provides == NULL)
+		return;
+
+	for (p = strtok_r(sp->provides, "\n", &sv); p != NULL;
+	     p = strtok_r(NULL, "\n", &sv)) {
+		/* "name=version" or just "name". */
+		q = strchr(p, '=');
+		if (q != NULL)
+			*q++ = '\0';
+		sidx_add_entry(b, p, name, repo, q != NULL ? q : "", 0, 0);
+	}
+}
+
+/* List the sync databases, their names (without ".db") and mtimes.
+   Returns the number of databases. */
+static size_t list_sync_dbs(char (**names)[256], int64_t **mtimes)
+{
+	DIR *d;
+	struct dirent *de;
+	struct stat st;
+	char path[PATH_MAX];
+	size_t len, n, cap;
+	void *rp;
+
+	*names = NULL;
+	*mtimes = NULL;
+	d = opendir(DEFAULT_SYNC_DIR);
+	if (d == NULL)
+		return (0);
+
+	n = cap = 0;
+	while ((de = readdir(d)) != NULL) {
+		len = strlen(de->d_name);
+		if (len < 4 || len - 3 >= 256 ||
+		    strcmp(de->d_name + len - 3, ".db") != 0)
+			continue;
+
+		snprintf(path, sizeof(path), DEFAULT_SYNC_DIR"/%s", de->d_name);
+		if (stat(path, &st) == -1)
+			continue;
+
+		if (n == cap) {
+			cap = cap == 0 ? (size_t)8 : cap * 2;
+			rp = realloc(*names, cap * sizeof(**names));
+			if (rp == NULL)
+				err(EXIT_FAILURE, "realloc()");
+			*names = rp;
+			rp = realloc(*mtimes, cap * sizeof(int64_t));
+			if (rp == NULL)
+				err(EXIT_FAILURE, "realloc()");
+			*mtimes = rp;
+		}
+
+		snprintf((*names)[n], (size_t)256, "%.*s", (int)(len - 3),
+			 de->d_name);
+		(*mtimes)[n] = (int64_t)st.st_mtime;
+		n++;
+	}
+
+	closedir(d);
+	return (n);
+}
+
+/* Set the section pointers of the index, after a sanity check.
+   Every bucket, chain link and string offset is checked too, so
+   a damaged cache file is rebuilt rather than read past its end. */
+static int sync_index_setup(struct sync_index *si)
+{
+	const struct sidx_header *h;
+	const struct sidx_entry *e;
+	size_t need, i;
+
+	if (si->size < sizeof(struct sidx_header))
+		return (-1);
+
+	h = (const struct sidx_header *)si->map;
+	if (memcmp(h->magic, SYNC_INDEX_MAGIC, (size_t)8) != 0)
+		return (-1);
+
+	need = sizeof(struct sidx_header) +
+		(size_t)h->ndbs * sizeof(struct sidx_db) +
+		(size_t)h->nbuckets * sizeof(uint32_t) +
+		(size_t)h->nentries * sizeof(struct sidx_entry) +
+		(size_t)h->strings_sz;
+	if (need != si->size)
+		return (-1);
+
+	/* Lookups mask the hash, it must be a power of two. */
+	if (h->nbuckets == 0 || (h->nbuckets & (h->nbuckets - 1)) != 0)
+		return (-1);
+
+	si->hdr = h;
+	si->dbs = (const struct sidx_db *)(h + 1);
+	si->buckets = (const uint32_t *)(si->dbs + h->ndbs);
+	si->entries = (const struct sidx_entry *)(si->buckets + h->nbuckets);
+	si->strings = (const char *)(si->entries + h->nentries);
+
+	/* Strings are read with str*(), the last one must end. */
+	if (h->strings_sz > 0 && si->strings[h->strings_sz - 1] != '\0')
+		return (-1);
+
+	for (i = 0; i < h->ndbs; i++)
+		if (si->dbs[i].name >= h->strings_sz)
+			return (-1);
+
+	/* Chain indices are shifted by one, so nentries is fine. */
+	for (i = 0; i < h->nbuckets; i++)
+		if (si->buckets[i] > h->nentries)
+			return (-1);
+
+	/* A chain always goes to an earlier entry, so it can't loop. */
+	for (i = 0; i < h->nentries; i++) {
+		e = &si->entries[i];
+		if (e->next > i || e->key >= h->strings_sz ||
+		    e->repo >= h->strings_sz || e->pkgname >= h->strings_sz ||
+		    e->version >= h->strings_sz)
+			return (-1);
+	}
+
+	return (0);
+}
+
+/* Does the index match the sync databases on the disk? */
+static int sync_index_fresh(const struct sync_index *si, char (*names)[256],
+			    const int64_t *mtimes, size_t ndbs)
+{
+	size_t i, j;
+
+	if (si->hdr->ndbs != ndbs)
+		return (0);
+
+	for (i = 0; i < ndbs; i++) {
+		for (j = 0; j < ndbs; j++)
+			if (strcmp(si->strings + si->dbs[j].name, names[i]) == 0)
+				break;
+		if (j == ndbs || si->dbs[j].mtime != mtimes[i])
+			return (0);
+	}
+
+	return (1);
+}
+
+/* Read all sync databases and lay out the index in memory. */
+static void build_sync_index(struct sync_index *si, char (*names)[256],
+			     const int64_t *mtimes, size_t ndbs)
+{
+	struct sidx_builder b;
+	struct sidx_header *h;
+	struct sidx_db *dbs;
+	struct sidx_entry *ents;
+	uint32_t *buckets, mask;
+	char path[PATH_MAX];
+	size_t i, nbuckets;
+	char *p;
+
+	memset(&b, '\0', sizeof(struct sidx_builder));
+	dbs = calloc(ndbs == 0 ? 1 : ndbs, sizeof(struct sidx_db));
+	if (dbs == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	for (i = 0; i < ndbs; i++) {
+		dbs[i].name = sidx_add_string(&b, names[i]);
+		dbs[i].mtime = mtimes[i];
+		snprintf(path, sizeof(path), DEFAULT_SYNC_DIR"/%s.db", names[i]);
+		if (read_sync_db(path, names[i], sidx_add_pkg, &b) == -1)
+			warnx("warning: cannot read '%s'.", path);
+	}
+
+	/* Power of two, at least twice the number of entries. */
+	nbuckets = (size_t)1024;
+	while (nbuckets < b.nentries * 2)
+		nbuckets *= 2;
+
+	si->size = sizeof(struct sidx_header) + ndbs * sizeof(struct sidx_db) +
+		nbuckets * sizeof(uint32_t) +
+		b.nentries * sizeof(struct sidx_entry) + b.strings.nsz;
+	si->map = calloc(si->size, sizeof(char));
+	if (si->map == NULL)
+		err(EXIT_FAILURE, "calloc()");
+	si->mapped = 0;
+
+	h = (struct sidx_header *)si->map;
+	memcpy(h->magic, SYNC_INDEX_MAGIC, (size_t)8);
+	h->ndbs = (uint32_t)ndbs;
+	h->nentries = (uint32_t)b.nentries;
+	h->nbuckets = (uint32_t)nbuckets;
+	h->strings_sz = (uint32_t)b.strings.nsz;
+
+	p = (char *)(h + 1);
+	memcpy(p, dbs, ndbs * sizeof(struct sidx_db));
+	buckets = (uint32_t *)(p + ndbs * sizeof(struct sidx_db));
+	ents = (struct sidx_entry *)(buckets + nbuckets);
+	memcpy(ents, b.entries, b.nentries * sizeof(struct sidx_entry));
+	if (b.strings.nsz > 0)
+		memcpy(ents + b.nentries, b.strings.resp, b.strings.nsz);
+
+	/* Chain indices are shifted by one, 0 ends the chain. */
+	mask = (uint32_t)nbuckets - 1;
+	for (i = 0; i < b.nentries; i++) {
+		p = b.strings.resp + ents[i].key;
+		ents[i].next = buckets[(uint32_t)fnv1a_hash(p) & mask];
+		buckets[(uint32_t)fnv1a_hash(p) & mask] = (uint32_t)i + 1;
+	}
+
+	free(dbs);
+	free(b.entries);
+	free(b.strings.resp);
+	sync_index_setup(si);
+}
+
+/* Open the sync index. It's kept in the cache directory and mapped,
+   and rebuilt when a sync database is added, removed or changed.
+   Returns -1 if there are no sync databases. */
+static int open_sync_index(struct sync_index *si)
+{
+	char (*names)[256];
+	int64_t *mtimes;
+	char *dir, *path, *tmp;
+	size_t ndbs, sz;
+	struct stat st;
+	FILE *fp;
+	int fd;
+
+	memset(si, '\0', sizeof(struct sync_index));
+	ndbs = list_sync_dbs(&names, &mtimes);
+	if (ndbs == 0)
+		return (-1);
+
+	dir = cache_dir_path();
+	path = tmp = NULL;
+	if (dir != NULL) {
+		sz = strlen(dir) + sizeof("/"SYNC_INDEX_NAME".tmp");
+		path = calloc(sz, sizeof(char));
+		tmp = calloc(sz, sizeof(char));
+		if (path == NULL || tmp == NULL)
+			err(EXIT_FAILURE, "calloc()");
+		snprintf(path, sz, "%s/"SYNC_INDEX_NAME, dir);
+		snprintf(tmp, sz, "%s/"SYNC_INDEX_NAME".%ld", dir, (long)getpid());
+
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd != -1) {
+			if (fstat(fd, &st) == 0 && st.st_size > 0) {
+				si->size = (size_t)st.st_size;
+				si->map = mmap(NULL, si->size, PROT_READ,
+					       MAP_PRIVATE, fd, (off_t)0);
+				if (si->map == MAP_FAILED)
+					si->map = NULL;
+				else
+					si->mapped = 1;
+			}
+			close(fd);
+		}
+
+		if (si->map != NULL && (sync_index_setup(si) == -1 ||
+		    sync_index_fresh(si, names, mtimes, ndbs) == 0)) {
+			munmap(si->map, si->size);
+			si->map = NULL;
+		}
+	}
+
+	/* Stale or missing, build a new one and save it. */
+	if (si->map == NULL) {
+		build_sync_index(si, names, mtimes, ndbs);
+		if (tmp != NULL) {
+			fp = fopen(tmp, "wb");
+			if (fp != NULL) {
+				fwrite(si->map, (size_t)1, si->size, fp);
+				if (fclose(fp) == 0 && rename(tmp, path) == 0)
+					tmp[0] = '\0';
+			}
+			if (tmp[0] != '\0')
+				unlink(tmp);
+		}
+	}
+
+	free(names);
+	free(mtimes);
+	free(path);
+	free(tmp);
+	free(dir);
+	return (0);
+}
+
+/* Close the sync index. */
+static void close_sync_index(struct sync_index *si)
+{
+	if (si->map == NULL)
+		return;
+
+	if (si->mapped)
+		munmap(si->map, si->size);
+	else
+		free(si->map);
+	memset(si, '\0', sizeof(struct sync_index));
+}
+
+/* First index entry of key, or NULL. Next ones can be found with
+   sync_index_next(), which are chained, but may have a different key. */
+static const struct sidx_entry *sync_index_find(const struct sync_index *si,
+						const char *key)
+{
+	uint32_t i;
+
+	if (si == NULL || si->map == NULL)
+		return (NULL);
+
+	i = si->buckets[(uint32_t)fnv1a_hash(key) & (si->hdr->nbuckets - 1)];
+	for (; i != 0; i = si->entries[i - 1].next)
+		if (strcmp(si->strings + si->entries[i - 1].key, key) == 0)
+			return (&si->entries[i - 1]);
+	return (NULL);
+}
+
+/* Next entry after e with the same key, or NULL. */
+static const struct sidx_entry *sync_index_next(const struct sync_index *si,
+						const struct sidx_entry *e)
+{
+	const char *key;
+	uint32_t i;
+
+	key = si->strings + e->key;
+	for (i = e->next; i != 0; i = si->entries[i - 1].next)
+		if (strcmp(si->strings + si->entries[i - 1].key, key) == 0)
+			return (&si->entries[i - 1]);
+	return (NULL);
+}
+
+/* Is there a package called name, in the sync databases?
+   Returns its entry, or NULL. */
+static const struct sidx_entry *sync_index_pkg(const struct sync_index *si,
+					       const char *name)
+{
+	const struct sidx_entry *e;
+
+	for (e = sync_index_find(si, name); e != NULL;
+	     e = sync_index_next(si, e))
+		if (e->is_name)
+			return (e);
+	return (NULL);
+}
+
+/* Note the result, if the sync databases have it, or
+   something which provides it. Those don't need a build. */
+static void render_repo_note(struct curl_memory *out,
+			     const struct sync_index *si, const char *name,
+			     int enable_colors)
+{
+	const struct sidx_entry *e;
+
+	e = sync_index_pkg(si, name);
+	if (e != NULL) {
+		mem_puts(out, enable_colors ? COLOR_LCYAN" (in " : " (in ");
+		mem_puts(out, si->strings + e->repo);
+		mem_puts(out, enable_colors ? ")"COLOR_END : ")");
+		return;
+	}
+
+	e = sync_index_find(si, name);
+	if (e == NULL)
+		return;
+
+	mem_puts(out, enable_colors ? COLOR_LCYAN" (provided by " :
+		 " (provided by ");
+	mem_puts(out, si->strings + e->repo);
+	mem_put(out, "/", (size_t)1);
+	mem_puts(out, si->strings + e->pkgname);
+	mem_puts(out, enable_colors ? ")"COLOR_END : ")");
+}
+
+/* Render a search result (its number is i + 1) into out. */
+static void render_search_row(struct curl_memory *out,
+			      const struct aur_store *st,
+			      const struct sync_index *si, size_t i,
+			      int enable_colors)
+{
+	if (enable_colors)
+		mem_puts(out, COLOR_PURPLE);
+	mem_put_uint(out, (uint64_t)i + 1);
+	mem_puts(out, enable_colors ? " "COLOR_BLUE"aur"COLOR_END"/"
+		 COLOR_WHITE : " aur/");
+	mem_puts(out, store_str(st, st->name[i]));
+	mem_puts(out, enable_colors ? COLOR_END" "COLOR_BGREEN"(" : " (");
+	mem_puts(out, store_str(st, st->version[i]));
+	mem_puts(out, enable_colors ? ")"COLOR_END COLOR_WHITE" (+" : ") (+");
+	mem_put_uint(out, st->numvotes[i]);
+	mem_put(out, " ", (size_t)1);
+	mem_put_fixed2(out, st->popularity[i]);
+	mem_puts(out, enable_colors ? "%)"COLOR_END : "%)");
+
+	/* Is there no maintainer? Package must be orphaned. */
+	if (st->maintainer[i] == STORE_NONE)
+		mem_puts(out, enable_colors ? COLOR_BRED" (Orphaned)"COLOR_END :
+			 " (Orphaned)");
+
+	/* Is the package out-of-date? */
+	if (st->outdated[i] > 0) {
+		mem_puts(out, enable_colors ? COLOR_BRED" (Out-of-date: " :
+			 " (Out-of-date: ");
+		mem_put_date(out, st->outdated[i]);
+		mem_puts(out, enable_colors ? ")"COLOR_END : ")");
+	}
+
+	render_repo_note(out, si, store_str(st, st->name[i]), enable_colors);
+	mem_puts(out, "\n ~> ");
+	mem_puts(out, store_str(st, st->description[i]));
+	mem_put(out, "\n", (size_t)1);
+}
+
+/* Write all of the buffer. Returns -1, if it can't. */
+static int write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		buf += n;
+		len -= (size_t)n;
+	}
+
+	return (0);
+}
+
+/* Start the pager, $PAGER or less (with $LESS, or "FRX", so it
+   stays on the screen after it's quit). Its standard input is
+   returned in fd. Returns its pid, or -1 if there's none. */
+static pid_t start_pager(int *fd)
+{
+	const char *pager;
+	pid_t pid;
+	int pfd[2];
+
+	pager = getenv("PAGER");
+	if (pager == NULL) {
+		if (access(DEFAULT_PAGER_PATH, X_OK) == -1)
+			return ((pid_t)-1);
+		pager = DEFAULT_PAGER_PATH;
+	}
+	if (*pager == '\0' || strcmp(pager, "cat") == 0)
+		return ((pid_t)-1);
+
+	if (pipe(pfd) == -1)
+		return ((pid_t)-1);
+
+	pid = fork();
+	if (pid == (pid_t)-1) {
+		close(pfd[0]);
+		close(pfd[1]);
+		return ((pid_t)-1);
+	}
+
+	if (pid == (pid_t)0) {
+		dup2(pfd[0], STDIN_FILENO);
+		close(pfd[0]);
+		close(pfd[1]);
+		setenv("LESS", "FRX", 0);
+		execl("/bin/sh", "sh", "-c", pager, (char *)NULL);
+		_exit(127);
+	}
+
+	close(pfd[0]);
+	*fd = pfd[1];
+	return (pid);
+}
+
+/* Pretty print all search results, and ask which ones to install.
+   Rows are rendered into a single buffer, which is written at once.
+   Listings longer than the terminal go to a pager, a page at a time,
+   and as it only reads what's shown, the rest is rendered lazily (or
+   not at all, once it's quit). */
+static void render_search_results(const struct aur_store *st,
+				  const struct sync_index *si,
+				  int enable_colors)
+{
+	struct curl_memory out;
+	struct winsize ws;
+	struct sigaction ign, oint, opipe;
+	size_t i, page;
+	pid_t pager;
+	int fd;
+
+	memset(&out, '\0', sizeof(struct curl_memory));
+	fd = STDOUT_FILENO;
+	pager = (pid_t)-1;
+	page = st->count;
+	if (isatty(STDOUT_FILENO) && isatty(STDIN_FILENO) &&
+	    ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 2 &&
+	    st->count * 2 > ws.ws_row) {
+		pager = start_pager(&fd);
+		if (pager != (pid_t)-1) {
+			page = ws.ws_row / 2;
+			/* It handles ^C by itself, and may be quit early. */
+			memset(&ign, '\0', sizeof(struct sigaction));
+			ign.sa_handler = SIG_IGN;
+			sigaction(SIGINT, &ign, &oint);
+			sigaction(SIGPIPE, &ign, &opipe);
+		}
+	}
+
+	/* Anything buffered by stdio goes first. */
+	fflush(stdout);
+	for (i = 0; i < st->count; i++) {
+		render_search_row(&out, st, si, i, enable_colors);
+		if (pager != (pid_t)-1 && ((i + 1) % page == 0 ||
+					   i + 1 == st->count)) {
+			if (write_all(fd, out.resp, out.nsz) == -1)
+				break;
+			out.nsz = 0;
+		}
+	}
+
+	if (pager != (pid_t)-1) {
+		out.nsz = 0;
+		close(fd);
+		while (waitpid(pager, NULL, 0) < 0 && errno == EINTR)
+			;
+		sigaction(SIGINT, &oint, NULL);
+		sigaction(SIGPIPE, &opipe, NULL);
+	}
+
+	/* The prompt doesn't end with a newline, it's in the
+	   same write. */
+	if (enable_colors)
+		mem_puts(&out, COLOR_BLUE":: "COLOR_END
+			 COLOR_WHITE"Packages to install (eg: 1 2 3):\n"
+			 COLOR_BLUE":: "COLOR_END);
+	else
+		mem_puts(&out, ":: Packages to install (eg: 1 2 3):\n:: ");
+	write_all(STDOUT_FILENO, out.resp, out.nsz);
+	free(out.resp);
+}
+
+/* Selected packages which share the same package base,
+   so they're downloaded and built only once. */
+struct pkg_group {
+	uint32_t base;
+	size_t first;
+	struct curl_memory names;
+};
+
+/* Parse the selection, like "1 2 3", into result indices.
+   Anything that isn't a number (or is out of range) is ignored,
+   same numbers are only taken once, and a tab ends the input.
+   Returns the number of selected results. */
+static size_t parse_selection(const char *input, size_t lcount, size_t **sel)
+{
+	const char *p;
+	char *end;
+	unsigned long v;
+	size_t i, n;
+	uint8_t *seen;
+
+	*sel = calloc(lcount, sizeof(size_t));
+	seen = calloc(lcount, sizeof(uint8_t));
+	if (*sel == NULL || seen == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	n = 0;
+	p = input;
+	while (*p != '\0' && *p != '\t') {
+		if (!isdigit((unsigned char)*p)) {
+			p++;
+			continue;
+		}
+
+		v = strtoul(p, &end, 10);
+		p = end;
+		if (v == 0 || v > lcount)
+			continue;
+
+		i = (size_t)v - 1;
+		if (seen[i] == 0) {
+			seen[i] = 1;
+			(*sel)[n++] = i;
+		}
+	}
+
+	free(seen);
+	return (n);
+}
+
+/* Group the selected results by their package base. As bases
+   are interned in the store, the same base has the same offset.
+   Packages which are in the sync databases are not built, their
+   names are added to repo (space separated) instead.
+   Returns the number of groups. */
+static size_t group_selection(const struct aur_store *st,
+			      const struct sync_index *si, const size_t *sel,
+			      size_t n, struct pkg_group **groups,
+			      struct curl_memory *repo)
+{
+	size_t i, j, ng;
+	struct pkg_group *g;
+
+	*groups = calloc(n == 0 ? 1 : n, sizeof(struct pkg_group));
+	if (*groups == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	ng = 0;
+	for (i = 0; i < n; i++) {
+		/* Results without a base can't be downloaded. */
+		if (st->url_base[sel[i]] == STORE_NONE ||
+		    st->url_path[sel[i]] == STORE_NONE ||
+		    st->name[sel[i]] == STORE_NONE)
+			continue;
+
+		if (sync_index_pkg(si, store_str(st, st->name[sel[i]])) != NULL) {
+			mem_append(repo, "%s%s", repo->nsz == 0 ? "" : " ",
+				   store_str(st, st->name[sel[i]]));
+			continue;
+		}
+
+		for (j = 0; j < ng; j++)
+			if ((*groups)[j].base == st->url_base[sel[i]])
+				break;
+
+		g = &(*groups)[j];
+		if (j == ng) {
+			g->base = st->url_base[sel[i]];
+			g->first = sel[i];
+			ng++;
+		}
+
+		/* Comma separated, like is_package_file() takes them. */
+		mem_append(&g->names, "%s%s", g->names.nsz == 0 ? "" : ",",
+			   store_str(st, st->name[sel[i]]));
+	}
+
+	return (ng);
+}
+
+/* Append the values of field, and of field with our architecture
+   (like "depends_x86_64"), in the package base's .SRCINFO to out. */
+static void read_srcinfo_arch(const char *pbase, const char *field,
+			      const char *arch, struct curl_memory *out)
+{
+	char name[128];
+
+	read_srcinfo(pbase, field, out);
+	snprintf(name, sizeof(name), "%s_%s", field, arch);
+	read_srcinfo(pbase, name, out);
+}
+
+/* Whether the package base depends on (or needs to build with) any
+   of the packages, or what they provide (space separated). */
+static int needs_any_of(const char *pbase, const char *names,
+			const char *arch)
+{
+	static const char *const fields[] = {
+		"depends", "makedepends", "checkdepends", NULL
+	};
+	struct curl_memory deps;
+	const char *const *f;
+	char *d, *sv, *p;
+	size_t len;
+	int found;
+
+	memset(&deps, '\0', sizeof(struct curl_memory));
+	for (f = fields; *f != NULL; f++)
+		read_srcinfo_arch(pbase, *f, arch, &deps);
+	if (deps.nsz == 0)
+		return (0);
+
+	found = 0;
+	for (d = strtok_r(deps.resp, " ", &sv); d != NULL && found == 0;
+	     d = strtok_r(NULL, " ", &sv)) {
+		/* Without the version constraint. */
+		d[strcspn(d, "<>=")] = '\0';
+		len = strlen(d);
+		if (len == 0)
+			continue;
+		for (p = strstr(names, d); p != NULL; p = strstr(p + 1, d)) {
+			if ((p == names || p[-1] == ' ') &&
+			    (p[len] == ' ' || p[len] == '\0')) {
+				found = 1;
+				break;
+			}
+		}
+	}
+
+	free(deps.resp);
+	return (found);
+}
+
+/* Add what the package base's packages provide to names (space
+   separated), without the versions. */
+static void add_srcinfo_provides(const char *pbase, const char *arch,
+				 struct curl_memory *names)
+{
+	struct curl_memory prov;
+	char *p, *sv;
+
+	memset(&prov, '\0', sizeof(struct curl_memory));
+	read_srcinfo_arch(pbase, "provides", arch, &prov);
+	if (prov.nsz == 0)
+		return;
+
+	for (p = strtok_r(prov.resp, " ", &sv); p != NULL;
+	     p = strtok_r(NULL, " ", &sv)) {
+		p[strcspn(p, "<>=")] = '\0';
+		if (*p != '\0')
+			mem_append(names, "%s ", p);
+	}
+
+	free(prov.resp);
+}
+
+/* Add the validpgpkeys of the package base's .SRCINFO to keys
+   (space separated), unless they're there already. Keys are
+   fingerprints or long key IDs, anything else is skipped. */
+static void read_srcinfo_keys(const char *pbase, struct curl_memory *keys)
+{
+	struct curl_memory vals;
+	char *sv, *p, *key;
+	size_t len;
+
+	memset(&vals, '\0', sizeof(struct curl_memory));
+	if (read_srcinfo(pbase, "validpgpkeys", &vals) == -1 || vals.nsz == 0)
+		return;
+
+	for (key = strtok_r(vals.resp, " ", &sv); key != NULL;
+	     key = strtok_r(NULL, " ", &sv)) {
+		len = strspn(key, "0123456789abcdefABCDEF");
+		if (key[len] != '\0' || (len != 16 && len != 40))
+			continue;
+		for (p = key; *p != '\0'; p++)
+			*p = (char)toupper((unsigned char)*p);
+
+		if (keys->resp != NULL && (p = strstr(keys->resp, key)) != NULL &&
+		    (p == keys->resp || p[-1] == ' ') && p[len] == ' ')
+			continue;
+		mem_append(keys, "%s ", key);
+	}
+
+	free(vals.resp);
+}
+
+/* Ask gpg about all keys (space separated) at once, and remove
+   the ones the keyring has already. A long key ID matches the end
+   of a fingerprint. Returns the number of missing keys. */
+static size_t drop_known_keys(char *keys)
+{
+	char **argv, *out, *line, *sv, *p, *key, *dst, *f;
+	size_t n, nmiss, len, i;
+
+	argv = calloc(strlen(keys) / 16 + 6, sizeof(char *));
+	if (argv == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	n = 0;
+	argv[n++] = DEFAULT_GPG_PATH;
+	argv[n++] = "--batch";
+	argv[n++] = "--with-colons";
+	argv[n++] = "--list-keys";
+	out = NULL;
+	p = strdup(keys);
+	if (p == NULL)
+		err(EXIT_FAILURE, "strdup()");
+	for (key = strtok_r(p, " ", &sv); key != NULL;
+	     key = strtok_r(NULL, " ", &sv))
+		argv[n++] = key;
+
+	/* Missing keys make it fail, but the others are still listed. */
+	run_program(NULL, argv, NULL, 0, &out);
+	free(argv);
+	free(p);
+
+	/* Fingerprints are the 10th field of "fpr" records. */
+	if (out != NULL) {
+		for (line = strtok_r(out, "\n", &sv); line != NULL;
+		     line = strtok_r(NULL, "\n", &sv)) {
+			if (strncmp(line, "fpr:", (size_t)4) != 0)
+				continue;
+			for (f = line, i = 0; i < 9 && f != NULL; i++) {
+				f = strchr(f, ':');
+				if (f != NULL)
+					f++;
+			}
+			if (f == NULL)
+				continue;
+			p = strchr(f, ':');
+			if (p != NULL)
+				*p = '\0';
+			len = strlen(f);
+
+			/* Blank out every key, which this one is. */
+			for (key = keys; *key != '\0'; key += n) {
+				key += strspn(key, " ");
+				n = strcspn(key, " ");
+				if (n > 0 && n <= len &&
+				    strncmp(f + len - n, key, n) == 0)
+					memset(key, ' ', n);
+			}
+		}
+		free(out);
+	}
+
+	/* Squeeze the spaces. */
+	nmiss = 0;
+	dst = keys;
+	for (key = keys; *key != '\0'; key += n) {
+		key += strspn(key, " ");
+		n = strcspn(key, " ");
+		if (n == 0)
+			break;
+		memmove(dst, key, n);
+		dst += n;
+		*dst++ = ' ';
+		nmiss++;
+	}
+	*dst = '\0';
+
+	return (nmiss);
+}
+
+/* A key being fetched from the keyserver. */
+struct key_fetch {
+	const char *key;
+	char *armor;
+	size_t armor_len;
+};
+
+/* Keep the key, if the keyserver has it. */
+static void key_done(struct aurpkg_ctx *ctx,
+		     const struct aurpkg_result *res, void *udata)
+{
+	struct key_fetch *kf;
+
+	(void)ctx;
+	kf = (struct key_fetch *)udata;
+	if (res->error != AURPKG_OK || res->http_code != 200 ||
+	    strstr(res->body, "BEGIN PGP PUBLIC KEY BLOCK") == NULL)
+		return;
+
+	kf->armor = malloc(res->body_len + 1);
+	if (kf->armor == NULL)
+		err(EXIT_FAILURE, "malloc()");
+	memcpy(kf->armor, res->body, res->body_len);
+	kf->armor[res->body_len] = '\0';
+	kf->armor_len = res->body_len;
+}
+
+/* Is the block, which the keyserver returned, only the key we asked
+   for? gpg shows what it would import, and the fingerprint of every
+   primary key in it must be (or end with the long ID of) the key.
+   Otherwise a keyserver could add any key to the keyring. */
+static int key_block_matches(const struct key_fetch *kf)
+{
+	char *argv[] = {
+		DEFAULT_GPG_PATH, "--batch", "--with-colons",
+		"--import-options", "show-only", "--import", NULL
+	};
+	char *out, *line, *sv, *f, *p;
+	size_t i, len, klen, nkeys;
+	int primary, ok;
+
+	out = NULL;
+	if (run_program(NULL, argv, kf->armor, kf->armor_len, &out) != 0 ||
+	    out == NULL) {
+		free(out);
+		return (0);
+	}
+
+	ok = 1;
+	nkeys = 0;
+	primary = 0;
+	klen = strlen(kf->key);
+	for (line = strtok_r(out, "\n", &sv); line != NULL && ok;
+	     line = strtok_r(NULL, "\n", &sv)) {
+		if (strncmp(line, "fpr:", (size_t)4) != 0) {
+			primary = strncmp(line, "pub:", (size_t)4) == 0;
+			continue;
+		}
+		if (primary == 0)
+			continue;
+		primary = 0;
+
+		/* Fingerprints are the 10th field. */
+		for (f = line, i = 0; i < 9 && f != NULL; i++) {
+			f = strchr(f, ':');
+			if (f != NULL)
+				f++;
+		}
+		if (f == NULL) {
+			ok = 0;
+			break;
+		}
+		p = strchr(f, ':');
+		if (p != NULL)
+			*p = '\0';
+		len = strlen(f);
+		nkeys++;
+		if (len < klen || strcasecmp(f + len - klen, kf->key) != 0)
+			ok = 0;
+	}
+
+	free(out);
+	return (ok && nkeys > 0);
+}
+
+/* Base URL of the keyserver, hkp:// and hkps:// are HTTP(S), and
+   hkp's default port is 11371. */
+static char *keyserver_url(const char *ks)
+{
+	struct curl_memory url;
+	const char *host;
+
+	memset(&url, '\0', sizeof(struct curl_memory));
+	if (strncmp(ks, "hkps://", (size_t)7) == 0) {
+		mem_append(&url, "https://%s", ks + 7);
+	} else if (strncmp(ks, "hkp://", (size_t)6) == 0) {
+		host = ks + 6;
+		mem_append(&url, "http://%.*s", (int)strcspn(host, "/"), host);
+		if (memchr(host, ':', strcspn(host, "/")) == NULL)
+			mem_append(&url, ":11371");
+	} else {
+		mem_append(&url, "%s", ks);
+	}
+
+	/* Without the trailing slashes. */
+	while (url.nsz > 0 && url.resp[url.nsz - 1] == '/')
+		url.resp[--url.nsz] = '\0';
+	return (url.resp);
+}
+
+/* Make sure the keyring has the keys, which the sources of the
+   package bases are signed with, before any of them is built.
+   Otherwise makepkg would only fail once everything is downloaded.
+   Missing keys are fetched from the keyserver at the same time,
+   and the blocks which are only the key asked for are imported
+   at once. */
+static void prefetch_pgp_keys(const struct aur_store *st,
+			      const struct pkg_group *groups, size_t ngroups,
+			      const struct arg_opts *opts)
+{
+	struct curl_memory keys, armor;
+	struct key_fetch *kf;
+	char *base, *sv, *key, *url;
+	size_t i, nmiss, nfound;
+	int id;
+	char *iargv[] = { DEFAULT_GPG_PATH, "--batch", "--import", NULL };
+
+	memset(&keys, '\0', sizeof(struct curl_memory));
+	for (i = 0; i < ngroups; i++)
+		read_srcinfo_keys(store_str(st, groups[i].base), &keys);
+	if (keys.nsz == 0)
+		return;
+
+	if (access(DEFAULT_GPG_PATH, X_OK) == -1) {
+		warn("access(): cannot check the PGP keys");
+		free(keys.resp);
+		return;
+	}
+
+	nmiss = drop_known_keys(keys.resp);
+	if (nmiss == 0) {
+		free(keys.resp);
+		return;
+	}
+
+	if (opts->is_colors)
+		fprintf(stdout, COLOR_BLUE":: "COLOR_WHITE
+			"Fetching %zu PGP key(s)...\n"COLOR_END, nmiss);
+	else
+		fprintf(stdout, ":: Fetching %zu PGP key(s)...\n", nmiss);
+
+	kf = calloc(nmiss, sizeof(struct key_fetch));
+	if (kf == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	base = keyserver_url(opts->keyserver != NULL
+			     ? opts->keyserver : DEFAULT_KEYSERVER);
+	i = 0;
+	for (key = strtok_r(keys.resp, " ", &sv); key != NULL && i < nmiss;
+	     key = strtok_r(NULL, " ", &sv), i++) {
+		kf[i].key = key;
+		memset(&armor, '\0', sizeof(struct curl_memory));
+		mem_append(&armor, "%s/pks/lookup?op=get&options=mr&search=0x%s",
+			   base, key);
+		url = armor.resp;
+		id = aurpkg_request(aur_context(), url, key_done, &kf[i]);
+		if (id < 0)
+			warnx("aurpkg_request(): %s",
+			      aurpkg_strerror((enum aurpkg_error)-id));
+		free(url);
+	}
+	aurpkg_run(aur);
+	free(base);
+
+	/* All of them go to a single import. */
+	memset(&armor, '\0', sizeof(struct curl_memory));
+	nfound = 0;
+	for (i = 0; i < nmiss; i++) {
+		if (kf[i].armor == NULL) {
+			warnx("warning: cannot fetch PGP key %s.", kf[i].key);
+			continue;
+		}
+		if (key_block_matches(&kf[i]) == 0) {
+			warnx("warning: keyserver returned other keys than %s, "
+			      "they're not imported.", kf[i].key);
+			free(kf[i].armor);
+			continue;
+		}
+		curl_write_cb(kf[i].armor, (size_t)1, kf[i].armor_len, &armor);
+		curl_write_cb("\n", (size_t)1, (size_t)1, &armor);
+		free(kf[i].armor);
+		nfound++;
+	}
+
+	if (nfound > 0 && run_program(NULL, iargv, armor.resp, armor.nsz, NULL) != 0)
+		warnx("warning: gpg cannot import the PGP keys.");
+
+	free(armor.resp);
+	free(kf);
+	free(keys.resp);
+}
+
+/* Download and extract a package base. */
+static void fetch_and_extract(const struct aur_store *st,
+			      const struct pkg_group *g, size_t didx,
+			      const struct prefetch *pf,
+			      const struct arg_opts *opts)
+{
+	const char *path, *pbase;
+	char *base;
+	int enable_colors;
+
+	enable_colors = opts->is_colors;
+	path = store_str(st, st->url_path[g->first]);
+	pbase = store_str(st, g->base);
+
+	base = base_name(path);
+	if (base == NULL)
+		errx(EXIT_FAILURE, "base_name(): Parsed URL is invalid.");
+
+	/* Colors. */
+	if (enable_colors)
+		fprintf(stdout, COLOR_BLUE":: "
+			COLOR_PURPLE"(%zu) "
+			COLOR_WHITE"Downloading %s (%s)...\n"COLOR_END,
+			didx, base, g->names.resp);
+	else
+		fprintf(stdout,
+			":: (%zu) "
+			"Downloading %s (%s)...\n", didx, base, g->names.resp);
+
+	if (take_prefetched(pf, pbase, base) == 0)
+		download_snapshot(base, pbase);
+
+	/* Colors. */
+	if (enable_colors)
+		fprintf(stdout,
+			COLOR_BLUE":: "COLOR_WHITE
+			"~> Extracting %s...\n"COLOR_END, base);
+	else
+		fprintf(stdout, ":: ~> Extracting %s...\n", base);
+
+	/* Check whether the file is a gzipped tarball or not. */
+	if (likely_targz_magic_sig(base) == 0)
+		errx(EXIT_FAILURE,
+		     "error: Downloaded archive is not "
+		     "a gzipped tarball.");
+
+	/* Decompress the gzipped tarball. */
+	targz_decompress_archive(base);
+}
+
+/* Percent-encode a string, to be used in a URL. */
+static char *url_escape(const char *str)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	char *p, *q;
+
+	p = calloc(strlen(str) * 3 + 1, sizeof(char));
+	if (p == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	for (q = p; *str != '\0'; str++) {
+		if ((*str >= 'a' && *str <= 'z') || (*str >= 'A' && *str <= 'Z') ||
+		    (*str >= '0' && *str <= '9') || strchr("-_.~@", *str) != NULL) {
+			*q++ = *str;
+		} else {
+			*q++ = '%';
+			*q++ = hex[(uint8_t)*str >> 4];
+			*q++ = hex[(uint8_t)*str & 0x0f];
+		}
+	}
+
+	return (p);
+}
+
+/* Duplicate the string, or exit on failure. */
+static char *xstrdup(const char *str)
+{
+	char *p;
+
+	p = strdup(str);
+	if (p == NULL)
+		err(EXIT_FAILURE, "strdup()");
+	return (p);
+}
+
+/* Copy of the field (like "%FILES%") of a pacman database entry.
+   Returns NULL, if it doesn't have it. */
+static char *db_field(const char *buf, const char *key)
+{
+	const char *p, *end;
+	char *val;
+	size_t len, klen;
+
+	klen = strlen(key);
+	for (p = buf; (p = strstr(p, key)) != NULL; p += klen)
+		if ((p == buf || p[-1] == '\n') && p[klen] == '\n')
+			break;
+	if (p == NULL)
+		return (NULL);
+
+	p += klen + 1;
+	end = strstr(p, "\n\n");
+	len = end == NULL ? strlen(p) : (size_t)(end - p);
+	if (len > 0 && p[len - 1] == '\n')
+		len--;
+
+	val = strndup(p, len);
+	if (val == NULL)
+		err(EXIT_FAILURE, "strndup()");
+	return (val);
+}
+
+/* A sorted list of names, to look them up. */
+struct name_list {
+	char **names;
+	size_t n;
+	size_t cap;
+};
+
+static void name_list_add(struct name_list *nl, const char *name)
+{
+	char **p;
+
+	if (nl->n == nl->cap) {
+		nl->cap = nl->cap == 0 ? 64 : nl->cap * 2;
+		p = realloc(nl->names, nl->cap * sizeof(char *));
+		if (p == NULL)
+			err(EXIT_FAILURE, "realloc()");
+		nl->names = p;
+	}
+
+	nl->names[nl->n] = strdup(name);
+	if (nl->names[nl->n] == NULL)
+		err(EXIT_FAILURE, "strdup()");
+	nl->n++;
+}
+
+static int name_compare(const void *a, const void *b)
+{
+	return (strcmp(*(char *const *)a, *(char *const *)b));
+}
+
+static void name_list_sort(struct name_list *nl)
+{
+	if (nl->n > 1)
+		qsort(nl->names, nl->n, sizeof(char *), name_compare);
+}
+
+static int name_list_has(const struct name_list *nl, const char *name)
+{
+	return (nl->n > 0 &&
+		bsearch(&name, nl->names, nl->n, sizeof(char *),
+			name_compare) != NULL);
+}
+
+static void name_list_free(struct name_list *nl)
+{
+	size_t i;
+
+	for (i = 0; i < nl->n; i++)
+		free(nl->names[i]);
+	free(nl->names);
+	memset(nl, '\0', sizeof(struct name_list));
+}
+
+/* A .SRCINFO being fetched for the install plan. */
+struct srcinfo_fetch {
+	const char *pbase;
+	time_t last_modified;
+	char *info;
+	size_t len;
+	int cached;
+};
+
+/* Install plan of the selected package bases. Dependencies are
+   kept without their version constraints. */
+struct install_plan {
+	struct name_list depends;
+	struct name_list makedepends;
+	struct name_list built;
+	struct curl_memory text;
+	struct curl_memory keys;
+	size_t nsources;
+	size_t fetched;
+	size_t ncached;
+	int enable_colors;
+};
+
+/* Keep the .SRCINFO, if cgit has it. */
+static void srcinfo_done(struct aurpkg_ctx *ctx,
+			 const struct aurpkg_result *res, void *udata)
+{
+	struct srcinfo_fetch *sf;
+
+	(void)ctx;
+	sf = (struct srcinfo_fetch *)udata;
+	if (res->error != AURPKG_OK || res->http_code != 200 ||
+	    strncmp(res->body, "pkgbase", (size_t)7) != 0)
+		return;
+
+	sf->info = strndup(res->body, res->body_len);
+	if (sf->info == NULL)
+		err(EXIT_FAILURE, "strndup()");
+	sf->len = res->body_len;
+}
+
+/* Is name in the list, separated by sep? */
+static int list_has(const char *list, const char *name, char sep)
+{
+	const char *p;
+	size_t len;
+
+	len = strlen(name);
+	for (p = strstr(list, name); p != NULL; p = strstr(p + 1, name))
+		if ((p == list || p[-1] == sep) &&
+		    (p[len] == sep || p[len] == '\0'))
+			return (1);
+	return (0);
+}
+
+/* Add the names of a list (separated by spaces or commas),
+   without their version constraints. */
+static void plan_add_names(struct name_list *nl, const char *list)
+{
+	char *copy, *p, *sv;
+
+	copy = xstrdup(list);
+	for (p = strtok_r(copy, " ,", &sv); p != NULL;
+	     p = strtok_r(NULL, " ,", &sv)) {
+		p[strcspn(p, "<>=")] = '\0';
+		if (*p != '\0')
+			name_list_add(nl, p);
+	}
+	free(copy);
+}
+
+/* Is the key field, or field with our architecture, like
+   "depends_x86_64"? Returns 0 or 1 for them, otherwise -1. */
+static int srcinfo_field(const char *key, const char *field,
+			 const char *arch)
+{
+	size_t len;
+
+	len = strlen(field);
+	if (strncmp(key, field, len) != 0)
+		return (-1);
+	if (key[len] == '\0')
+		return (0);
+	if (key[len] == '_' && strcmp(key + len + 1, arch) == 0)
+		return (1);
+	return (-1);
+}
+
+/* Add a source to the plan. It's "name::url" or just "url", and
+   the ones without a scheme are files in the snapshot. */
+static void plan_add_source(struct install_plan *plan, const char *src)
+{
+	const char *url, *p;
+
+	p = strstr(src, "::");
+	url = p != NULL ? p + 2 : src;
+	plan->nsources++;
+	if (strstr(url, "://") == NULL) {
+		mem_append(&plan->text, "   %s (in the snapshot)\n", url);
+		return;
+	}
+
+	/* "git+https://...", VCS sources are cloned. */
+	p = strchr(url, '+');
+	if (p != NULL && p < strstr(url, "://"))
+		mem_append(&plan->text, "   %s (%.*s)\n", url,
+			   (int)(p - url), url);
+	else
+		mem_append(&plan->text, "   %s\n", url);
+}
+
+/* Show the package base, with its version, once. */
+static void plan_add_base(struct install_plan *plan, const char *pbase,
+			  const char *names, const char *const ver[3])
+{
+	if (plan->enable_colors)
+		mem_append(&plan->text, COLOR_BLUE":: "COLOR_WHITE"%s"COLOR_END
+			   " %s%s%s-%s (%s)\n", pbase,
+			   ver[0] != NULL ? ver[0] : "", ver[0] != NULL ? ":" : "",
+			   ver[1] != NULL ? ver[1] : "?",
+			   ver[2] != NULL ? ver[2] : "?", names);
+	else
+		mem_append(&plan->text, ":: %s %s%s%s-%s (%s)\n", pbase,
+			   ver[0] != NULL ? ver[0] : "", ver[0] != NULL ? ":" : "",
+			   ver[1] != NULL ? ver[1] : "?",
+			   ver[2] != NULL ? ver[2] : "?", names);
+}
+
+/* Parse a .SRCINFO of a package base, in place, and add what the
+   selected packages (names, separated by commas) need to the plan.
+   A package section overrides the base's depends and provides. */
+static void plan_add_srcinfo(struct install_plan *plan, char *info,
+			     const char *pbase, const char *names,
+			     const char *arch)
+{
+	static const char *const over[] = { "depends", "provides" };
+	struct curl_memory base[2][2], pkg[2][2];
+	const char *ver[3];
+	char *line, *sv, *key, *val, *p;
+	int has[2][2], in_pkg, selected, shown, f, a;
+	struct name_list *nl;
+
+	memset(base, '\0', sizeof(base));
+	memset(pkg, '\0', sizeof(pkg));
+	memset(has, '\0', sizeof(has));
+	ver[0] = ver[1] = ver[2] = NULL;
+	in_pkg = selected = shown = 0;
+	key = val = NULL;
+
+	for (line = strtok_r(info, "\n", &sv); ;
+	     line = strtok_r(NULL, "\n", &sv)) {
+		if (line != NULL) {
+			key = line + strspn(line, " \t");
+			p = strchr(key, '=');
+			if (p == NULL || *key == '#')
+				continue;
+			val = p + 1;
+			val += strspn(val, " \t");
+			while (p > key && (p[-1] == ' ' || p[-1] == '\t'))
+				p--;
+			*p = '\0';
+		}
+
+		/* A section starts (or it's the end), so the previous
+		   package is done. */
+		if (line == NULL || (*line != ' ' && *line != '\t')) {
+			for (f = 0; f < 2 && selected; f++) {
+				nl = f == 0 ? &plan->depends : &plan->built;
+				for (a = 0; a < 2; a++) {
+					if (has[f][a] && pkg[f][a].resp != NULL)
+						plan_add_names(nl, pkg[f][a].resp);
+					else if (has[f][a] == 0 &&
+						 base[f][a].resp != NULL)
+						plan_add_names(nl, base[f][a].resp);
+					has[f][a] = 0;
+					pkg[f][a].nsz = 0;
+					if (pkg[f][a].resp != NULL)
+						pkg[f][a].resp[0] = '\0';
+				}
+			}
+			if (line == NULL)
+				break;
+
+			in_pkg = strcmp(key, "pkgname") == 0;
+			selected = in_pkg && list_has(names, val, ',');
+			if (in_pkg && shown == 0) {
+				plan_add_base(plan, pbase, names, ver);
+				shown = 1;
+			}
+			continue;
+		}
+
+		if (in_pkg && selected == 0)
+			continue;
+
+		for (f = 0; f < 2; f++) {
+			a = srcinfo_field(key, over[f], arch);
+			if (a == -1)
+				continue;
+			if (in_pkg)
+				has[f][a] = 1;
+			if (*val != '\0')
+				mem_append(in_pkg ? &pkg[f][a] : &base[f][a],
+					   "%s ", val);
+		}
+		if (in_pkg)
+			continue;
+
+		if (strcmp(key, "epoch") == 0) {
+			ver[0] = val;
+		} else if (strcmp(key, "pkgver") == 0) {
+			ver[1] = val;
+		} else if (strcmp(key, "pkgrel") == 0) {
+			ver[2] = val;
+		} else if (srcinfo_field(key, "makedepends", arch) != -1 ||
+			   srcinfo_field(key, "checkdepends", arch) != -1) {
+			plan_add_names(&plan->makedepends, val);
+		} else if (srcinfo_field(key, "source", arch) != -1) {
+			if (shown == 0) {
+				plan_add_base(plan, pbase, names, ver);
+				shown = 1;
+			}
+			plan_add_source(plan, val);
+		} else if (strcmp(key, "validpgpkeys") == 0 && *val != '\0' &&
+			   (plan->keys.resp == NULL ||
+			    list_has(plan->keys.resp, val, ' ') == 0)) {
+			mem_append(&plan->keys, "%s%s",
+				   plan->keys.nsz == 0 ? "" : " ", val);
+		}
+	}
+
+	for (f = 0; f < 2; f++)
+		for (a = 0; a < 2; a++) {
+			free(base[f][a].resp);
+			free(pkg[f][a].resp);
+		}
+}
+
+/* Names of the installed packages, and what they provide. */
+static void read_installed(struct name_list *nl)
+{
+	DIR *dp;
+	struct dirent *de;
+	char path[PATH_MAX];
+	char *desc, *name, *prov, *p, *sv;
+
+	dp = opendir(DEFAULT_LOCAL_DIR);
+	if (dp == NULL)
+		return;
+
+	while ((de = readdir(dp)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		snprintf(path, sizeof(path), DEFAULT_LOCAL_DIR"/%s/desc",
+			 de->d_name);
+		desc = read_whole_file(path);
+		if (desc == NULL)
+			continue;
+
+		name = db_field(desc, "%NAME%");
+		if (name != NULL)
+			name_list_add(nl, name);
+		prov = db_field(desc, "%PROVIDES%");
+		for (p = prov == NULL ? NULL : strtok_r(prov, "\n", &sv);
+		     p != NULL; p = strtok_r(NULL, "\n", &sv)) {
+			p[strcspn(p, "=")] = '\0';
+			name_list_add(nl, p);
+		}
+
+		free(prov);
+		free(name);
+		free(desc);
+	}
+
+	closedir(dp);
+	name_list_sort(nl);
+}
+
+/* Add a package of the sync databases, which provides name, to the
+   ones pacman would download (space separated, as "repo/pkgname"),
+   and its size to dlsize. Returns 0 if it's there already. */
+static int plan_add_repo_pkg(const struct sync_index *si, const char *name,
+			     struct curl_memory *pkgs, const char *note,
+			     uint64_t *dlsize)
+{
+	const struct sidx_entry *e;
+	char *rp;
+	size_t sz;
+	int added;
+
+	e = sync_index_pkg(si, name);
+	if (e == NULL && (e = sync_index_find(si, name)) != NULL)
+		e = sync_index_pkg(si, si->strings + e->pkgname);
+	if (e == NULL)
+		return (0);
+
+	sz = strlen(si->strings + e->repo) + strlen(si->strings + e->pkgname) + 2;
+	rp = calloc(sz, sizeof(char));
+	if (rp == NULL)
+		err(EXIT_FAILURE, "calloc()");
+	snprintf(rp, sz, "%s/%s", si->strings + e->repo,
+		 si->strings + e->pkgname);
+
+	added = pkgs->resp == NULL || list_has(pkgs->resp, rp, ' ') == 0;
+	if (added) {
+		mem_append(pkgs, "%s%s%s", pkgs->nsz == 0 ? "" : " ", rp, note);
+		*dlsize += e->csize;
+	}
+
+	free(rp);
+	return (added);
+}
+
+/* Plan the install of the selected package bases from their .SRCINFO
+   alone, which is a few KB, instead of their snapshots. They're all
+   fetched at once, and cached until the package is modified (then
+   its LastModified changes, which is kept as the file's mtime).
+   Shows the sources, the PGP keys, and where the dependencies come
+   from. Only the direct dependencies are known, so the download
+   size is without the dependencies of the repository packages. */
+static void plan_install(const struct aur_store *st,
+			 const struct sync_index *si,
+			 const struct pkg_group *groups, size_t ngroups,
+			 const char *repo, int enable_colors)
+{
+	struct install_plan plan;
+	struct srcinfo_fetch *sf;
+	struct name_list installed;
+	struct curl_memory dir, path, from_repo, from_aur;
+	struct utsname un;
+	struct stat sb;
+	struct timespec ts[2];
+	const char *d, *prev;
+	char *esc, *names, *p, *sv;
+	uint64_t dlsize;
+	size_t i, j, ninstalled, nbuilt, nrepo, naur, nreq;
+	int id;
+
+	memset(&plan, '\0', sizeof(struct install_plan));
+	memset(&installed, '\0', sizeof(struct name_list));
+	memset(&dir, '\0', sizeof(struct curl_memory));
+	memset(&path, '\0', sizeof(struct curl_memory));
+	memset(&from_repo, '\0', sizeof(struct curl_memory));
+	memset(&from_aur, '\0', sizeof(struct curl_memory));
+	plan.enable_colors = enable_colors;
+	if (uname(&un) == -1)
+		err(EXIT_FAILURE, "uname()");
+
+	sf = calloc(ngroups == 0 ? 1 : ngroups, sizeof(struct srcinfo_fetch));
+	if (sf == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	p = cache_dir_path();
+	if (p != NULL) {
+		mem_append(&dir, "%s/"SRCINFO_CACHE_NAME, p);
+		if (make_dir(dir.resp) == -1)
+			dir.nsz = 0;
+		free(p);
+	}
+
+	nreq = 0;
+	for (i = 0; i < ngroups; i++) {
+		sf[i].pbase = store_str(st, groups[i].base);
+		sf[i].last_modified = st->last_modified[groups[i].first];
+		if (dir.nsz > 0 && sf[i].last_modified != 0) {
+			path.nsz = 0;
+			mem_append(&path, "%s/%s", dir.resp, sf[i].pbase);
+			if (stat(path.resp, &sb) == 0 &&
+			    sb.st_mtime == sf[i].last_modified &&
+			    (sf[i].info = read_whole_file(path.resp)) != NULL) {
+				sf[i].cached = 1;
+				continue;
+			}
+		}
+
+		/* Package bases may have a "+". */
+		esc = url_escape(sf[i].pbase);
+		path.nsz = 0;
+		mem_append(&path, AUR_SRCINFO_PATH"%s", esc);
+		free(esc);
+		id = aurpkg_request(aur_context(), path.resp, srcinfo_done, &sf[i]);
+		if (id < 0)
+			warnx("aurpkg_request(): %s",
+			      aurpkg_strerror((enum aurpkg_error)-id));
+		else
+			nreq++;
+	}
+	if (nreq > 0)
+		aurpkg_run(aur);
+
+	for (i = 0; i < ngroups; i++) {
+		if (sf[i].info == NULL) {
+			warnx("warning: cannot fetch the .SRCINFO of '%s'.",
+			      sf[i].pbase);
+			continue;
+		}
+
+		if (sf[i].cached) {
+			plan.ncached++;
+		} else {
+			plan.fetched += sf[i].len;
+			if (dir.nsz > 0 && sf[i].last_modified != 0) {
+				path.nsz = 0;
+				mem_append(&path, "%s/%s", dir.resp, sf[i].pbase);
+				write_whole_file(path.resp, sf[i].info);
+				ts[0].tv_sec = ts[1].tv_sec = sf[i].last_modified;
+				ts[0].tv_nsec = ts[1].tv_nsec = 0;
+				utimensat(AT_FDCWD, path.resp, ts, 0);
+			}
+		}
+
+		plan_add_names(&plan.built, groups[i].names.resp);
+		plan_add_srcinfo(&plan, sf[i].info, sf[i].pbase,
+				 groups[i].names.resp, un.machine);
+		free(sf[i].info);
+	}
+
+	/* Binary packages, which were selected. */
+	dlsize = 0;
+	nrepo = 0;
+	names = xstrdup(repo);
+	for (p = strtok_r(names, " ", &sv); p != NULL;
+	     p = strtok_r(NULL, " ", &sv))
+		nrepo += (size_t)plan_add_repo_pkg(si, p, &from_repo, "",
+						   &dlsize);
+	free(names);
+
+	/* Dependencies, then the ones which are only needed for
+	   the build. Same names are next to each other. */
+	read_installed(&installed);
+	name_list_sort(&plan.built);
+	name_list_sort(&plan.depends);
+	name_list_sort(&plan.makedepends);
+	ninstalled = nbuilt = naur = 0;
+	for (j = 0; j < 2; j++) {
+		prev = NULL;
+		for (i = 0; i < (j == 0 ? plan.depends.n : plan.makedepends.n); i++) {
+			d = j == 0 ? plan.depends.names[i] : plan.makedepends.names[i];
+			if ((prev != NULL && strcmp(prev, d) == 0) ||
+			    (j == 1 && name_list_has(&plan.depends, d))) {
+				prev = d;
+				continue;
+			}
+			prev = d;
+
+			if (name_list_has(&plan.built, d)) {
+				nbuilt++;
+			} else if (name_list_has(&installed, d)) {
+				ninstalled++;
+			} else if (sync_index_find(si, d) != NULL) {
+				nrepo += (size_t)plan_add_repo_pkg(si, d, &from_repo,
+								   j == 1 ? " (make)" : "",
+								   &dlsize);
+			} else {
+				mem_append(&from_aur, "%s%s%s",
+					   from_aur.nsz == 0 ? "" : " ", d,
+					   j == 1 ? " (make)" : "");
+				naur++;
+			}
+		}
+	}
+
+	if (enable_colors)
+		mem_append(&plan.text, COLOR_BLUE":: "COLOR_WHITE
+			   "Dependencies:"COLOR_END
+			   " %zu installed, %zu built here\n",
+			   ninstalled, nbuilt);
+	else
+		mem_append(&plan.text, ":: Dependencies: %zu installed, "
+			   "%zu built here\n", ninstalled, nbuilt);
+	if (from_repo.nsz > 0)
+		mem_append(&plan.text, "   From the repositories (%zu, "
+			   "%.2lf MiB): %s\n", nrepo,
+			   (double)dlsize / (1024.0 * 1024.0), from_repo.resp);
+	if (from_aur.nsz > 0)
+		mem_append(&plan.text, "   Not in the repositories (%zu): %s\n",
+			   naur, from_aur.resp);
+	if (plan.keys.nsz > 0)
+		mem_append(&plan.text, enable_colors
+			   ? COLOR_BLUE":: "COLOR_WHITE"PGP keys:"COLOR_END" %s\n"
+			   : ":: PGP keys: %s\n", plan.keys.resp);
+	mem_append(&plan.text, enable_colors
+		   ? COLOR_BLUE":: "COLOR_WHITE"Sources:"COLOR_END
+		   " %zu, %.2lf KiB of .SRCINFO fetched (%zu cached)\n"
+		   : ":: Sources: %zu, %.2lf KiB of .SRCINFO fetched "
+		   "(%zu cached)\n", plan.nsources,
+		   (double)plan.fetched / 1024.0, plan.ncached);
+
+	/* All at once. */
+	fwrite(plan.text.resp, (size_t)1, plan.text.nsz, stdout);
+
+	name_list_free(&installed);
+	name_list_free(&plan.depends);
+	name_list_free(&plan.makedepends);
+	name_list_free(&plan.built);
+	free(plan.text.resp);
+	free(plan.keys.resp);
+	free(from_repo.resp);
+	free(from_aur.resp);
+	free(dir.resp);
+	free(path.resp);
+	free(sf);
+}
+
+/* Show the results, then download and build the selected ones. */
+static void install_search_results(const struct aur_store *st,
+				   const struct arg_opts *opts)
+{
+	size_t nsel, ngroups, i, j;
+	const char *pbase;
+	size_t *sel;
+	char vstdin[256];
+	struct sync_index si;
+	struct prefetch pf;
+	struct pkg_group *groups;
+	struct curl_memory repo, built, pending;
+	struct utsname un;
+	int enable_colors;
+
+	enable_colors = opts->is_colors;
+	if (uname(&un) == -1)
+		err(EXIT_FAILURE, "uname()");
+
+	/* Download and build everything in the build root. */
+	if (opts->build_root != NULL) {
+		if (make_dir(opts->build_root) == -1)
+			err(EXIT_FAILURE, "mkdir()");
+		if (chdir(opts->build_root) == -1)
+			err(EXIT_FAILURE, "chdir()");
+	}
+
+	/* Results, which the sync databases have, are flagged. */
+	open_sync_index(&si);
+	render_search_results(st, &si, enable_colors);
+	/* Start downloading the likely ones, while we wait. */
+	start_prefetch(st, opts->prefetch, &pf);
+	atexit(cleanup_prefetch_atexit);
+
+	/* This section is for reading the input stream and parse
+	   that stream. After that, download the specific tarball
+	   which was provided by the input. */
+
+        /* Fill the buffers with zeros. */
+	memset(vstdin, '\0', sizeof(vstdin));
+	/* Read input from standard input. */
+	read(STDIN_FILENO, vstdin, sizeof(vstdin) - 1);
+	stop_prefetch(&pf);
+
+	/* Group the selection by package base, then
+	   download and build each base only once. */
+	memset(&repo, '\0', sizeof(struct curl_memory));
+	nsel = parse_selection(vstdin, st->count, &sel);
+	ngroups = group_selection(st, &si, sel, nsel, &groups, &repo);
+	if (ngroups == 0 && repo.nsz == 0)
+		fputs(" there is nothing to do\n", stderr);
+
+	/* With -n, only show what they need. */
+	if (opts->is_plan) {
+		plan_install(st, &si, groups, ngroups, repo.resp != NULL
+			     ? repo.resp : "", enable_colors);
+		for (i = 0; i < ngroups; i++)
+			free(groups[i].names.resp);
+		ngroups = 0;
+		repo.nsz = 0;
+	}
+
+	/* Binary packages first, they only take a moment. */
+	if (repo.nsz > 0)
+		install_from_repos(repo.resp, enable_colors);
+
+	/* Everything is downloaded and the keys are there, before
+	   the first build. */
+	for (i = 0; i < ngroups; i++)
+		fetch_and_extract(st, &groups[i], i + 1, &pf, opts);
+	prefetch_pgp_keys(st, groups, ngroups, opts);
+
+	/* Use the package base, as it'd be the name of
+	   the directory after the extraction. */
+	if (opts->is_install_once == 0) {
+		for (i = 0; i < ngroups; i++)
+			makepkg_and_install(store_str(st, groups[i].base),
+					    groups[i].names.resp, NULL, opts);
+	} else {
+		/* Build everything, then install them at once. Unless a
+		   build needs packages, which were built before it. */
+		memset(&built, '\0', sizeof(struct curl_memory));
+		memset(&pending, '\0', sizeof(struct curl_memory));
+		for (i = 0; i < ngroups; i++) {
+			pbase = store_str(st, groups[i].base);
+			if (pending.nsz > 0 &&
+			    needs_any_of(pbase, pending.resp, un.machine)) {
+				install_built_packages(&built, enable_colors);
+				pending.nsz = 0;
+				pending.resp[0] = '\0';
+			}
+
+			makepkg_and_install(pbase, groups[i].names.resp,
+					    &built, opts);
+			for (j = 0; j < groups[i].names.nsz; j++)
+				mem_append(&pending, "%c",
+					   groups[i].names.resp[j] == ','
+					   ? ' ' : groups[i].names.resp[j]);
+			mem_append(&pending, " ");
+			add_srcinfo_provides(pbase, un.machine, &pending);
+		}
+		install_built_packages(&built, enable_colors);
+		free(built.resp);
+		free(pending.resp);
+	}
+
+	for (i = 0; i < ngroups; i++)
+		free(groups[i].names.resp);
+	free(groups);
+	free(sel);
+	free(repo.resp);
+
+	close_sync_index(&si);
+	cleanup_prefetch(&pf);
+}
+
+/* Pretty print all search results and add them to the result store.
+   It takes the ownership of the response buffer, and frees it (and
+   the JSON tree) as soon as the results are in the store. */
+static MAIN_ONLY void print_search_results(char *json, const struct arg_opts *opts)
+{
+	size_t lcount;
+	JSON_Value *jsch;
+        struct aur_store st;
+
+	jsch = json_parse_string(json);
+	lcount = collect_search_results(json_object(jsch), &st);
+	json_value_free(jsch);
+	free(json);
+
+	if (lcount == (size_t)0) {
+		fputs("error: no package results were found.\n",
+		      stderr);
+		return;
+	}
+
+	install_search_results(&st, opts);
+	free_search_results(&st);
+}
+
+/* Request for AUR package information. */
+static char *request_aur_info_endpoint(const char *url)
+{
+	/* Return the response.  */
+	return (budgeted_request(url));
+}
+
+/* Format the path for AUR_INFO_PATH. */
+static char *format_info_package(const char *pkg)
+{
+        char *p;
+	size_t asz;
+
+	asz = strlen(pkg);
+	p = calloc((size_t)9 + asz + sizeof(AUR_INFO_PATH), sizeof(char));
+	if (p == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	/* Add proper size and name. */
+	memcpy(p, AUR_INFO_PATH, sizeof(AUR_INFO_PATH) - 1);
+        memcpy(p + sizeof(AUR_INFO_PATH) - 1, "?arg[]=", (size_t)7);
+	memcpy(p + sizeof(AUR_INFO_PATH) - 1 + (size_t)7, pkg, asz);
+
+        return (p);
+}
+
+/* Format the output and then print it. */
+static void format_print_package_info(struct aur_pkg_info aur_info,
+				      int enable_colors)
+{
+	static const char *const labels[] = {
+		"Package Name", "Description", "URL", "Version", "Outdated",
+		"Votes", "First Submitted", "Last Modified", "Popularity",
+		"Depends", "Licenses", "Keywords", "Opt-Depends"
+	};
+	const char *values[ARRAY_SIZE(labels)];
+	struct curl_memory out;
+	size_t i;
+
+	memset(values, '\0', sizeof(values));
+	values[0] = aur_info.name;
+	values[1] = aur_info.description;
+	values[2] = aur_info.url;
+	values[3] = aur_info.version;
+	values[9] = aur_info.depends;
+	values[10] = aur_info.licenses;
+	values[11] = aur_info.keywords;
+	values[12] = aur_info.optdeps;
+
+	/* Everything goes to the buffer, and then it's written at once. */
+	memset(&out, '\0', sizeof(struct curl_memory));
+	for (i = 0; i < ARRAY_SIZE(labels); i++) {
+		mem_puts(&out, enable_colors ? COLOR_BLUE":: "COLOR_WHITE : ":: ");
+		mem_puts(&out, labels[i]);
+		mem_puts(&out, enable_colors ? ":"COLOR_END" " : ": ");
+
+		switch (i) {
+		case 4:
+			if (aur_info.outdated > (time_t)0)
+				mem_put_date(&out, aur_info.outdated);
+			else
+				mem_puts(&out, "No");
+			break;
+		case 5:
+			mem_put_uint(&out, aur_info.num_votes);
+			break;
+		case 6:
+			mem_put_date(&out, aur_info.first_sub);
+			break;
+		case 7:
+			mem_put_date(&out, aur_info.last_mod);
+			break;
+		case 8:
+			mem_put_fixed2(&out, aur_info.popularity);
+			mem_put(&out, "%", (size_t)1);
+			break;
+		default:
+			mem_puts(&out, values[i] != NULL ? values[i] : "none");
+			break;
+		}
+		mem_put(&out, "\n", (size_t)1);
+	}
+
+	fflush(stdout);
+	write_all(STDOUT_FILENO, out.resp, out.nsz);
+
+	/* Unmap all mapped spaces. */
+	free(out.resp);
+	free(aur_info.depends);
+        free(aur_info.licenses);
+	free(aur_info.keywords);
+	free(aur_info.optdeps);        
+}
+
+/* Join all strings of a JSON array, separated by a space.
+   If the array is empty (or missing), it returns "none". */
+static char *join_json_array(JSON_Object *jao, const char *key)
+{
+	const char *vs;
+	char *p, *r;
+	JSON_Array *jar;
+	size_t asz, bsz, csz, i;
+
+	jar = json_object_get_array(jao, key);
+	asz = json_array_get_count(jar);
+	p = calloc((size_t)5, sizeof(char));
+	if (p == NULL)
+	        err(EXIT_FAILURE, "calloc()");
+
+	/* Check if there are elements or not. */
+	if (asz >= 1) {
+		for (i = 0; i < asz; i++) {
+			vs = json_array_get_string(jar, i);
+			bsz = strlen(p);
+			csz = strlen(vs) + (size_t)4;
+			r = realloc(p, bsz + csz);
+			if (r == NULL)
+				err(EXIT_FAILURE, "realloc()");
+
+			p = r;
+			memcpy(p + bsz, vs, csz - 4);
+			memcpy(p + bsz + csz - 4, " ", 2);
+		}
+	} else {
+		memcpy(p, "none", (size_t)4);
+	}
+
+	return (p);
+}
+
+/* Set all values from the JSON object to aur_pkg_info structure. */
+static void collect_package_info(JSON_Object *jao,
+				 struct aur_pkg_info *aur_info)
+{
+	/* Retrieve information from the JSON. */
+	aur_info->name = json_object_get_string(jao, "Name");
+        aur_info->description = json_object_get_string(jao, "Description");
+	aur_info->url = json_object_get_string(jao, "URL");
+	if (aur_info->url == NULL)
+		aur_info->url = "none";
+
+	aur_info->version = json_object_get_string(jao, "Version");
+	aur_info->outdated = (time_t)json_object_get_number(jao, "OutOfDate");
+        aur_info->num_votes = (uint32_t)json_object_get_number(jao, "NumVotes");
+	aur_info->first_sub = (time_t)json_object_get_number(jao, "FirstSubmitted");
+	aur_info->last_mod = (time_t)json_object_get_number(jao, "LastModified");
+	aur_info->popularity = json_object_get_number(jao, "Popularity");
+
+	/* List of depends, licenses, keywords and optional depends. */
+	aur_info->depends = join_json_array(jao, "Depends");
+	aur_info->licenses = join_json_array(jao, "License");
+	aur_info->keywords = join_json_array(jao, "Keywords");
+	aur_info->optdeps = join_json_array(jao, "OptDepends");
+}
+
+/* Set all values to aur_pkg_info structure, and then call
+   the format function to print it out. */
+static MAIN_ONLY void print_package_info(const char *pkg, int enable_colors)
+{
+        char *fmt, *json;
+	JSON_Value *jsv;
+        JSON_Object *jso, *jao;
+	JSON_Array *jar;
+	struct aur_pkg_info aur_info;
+
+	/* Format the URL. */
+        fmt = format_info_package(pkg);
+	json = request_aur_info_endpoint(fmt);
+	jsv = json_parse_string(json);
+	jso = json_object(jsv);
+	jar = json_object_get_array(jso, "results");
+	/* Get the first array from the results. */
+	jao = json_array_get_object(jar, 0);
+
+	/* Check if results array has some objects. */
+	if (json_array_get_count(jar) == 0) {
+		free(fmt);
+		free(json);
+		fprintf(stderr,
+			"error: no package was found called '%s'.\n",
+			pkg);
+		exit(EXIT_FAILURE);
+	}
+
+	collect_package_info(jao, &aur_info);
+	format_print_package_info(aur_info, enable_colors);
+	json_value_free(jsv);
+	free(fmt);
+	free(json);
+}
+
+/* A package providing something in the AUR. Sync databases
+   are in the sync index, so they aren't kept here. */
+struct provider {
+	char *provide;
+	char *version;
+	char *pkgname;
+	char *source;
+	uint32_t votes;
+	double popularity;
+	size_t next;
+	int dead;
+};
+
+/* When a source was last refreshed. 'Q' keys are names queried
+   in the AUR. */
+struct index_stamp {
+	char kind;
+	char *key;
+	time_t t;
+};
+
+/* Persistent provider index, a hash table of provide names. */
+struct provider_index {
+	struct provider *prov;
+	size_t count;
+	size_t cap;
+	size_t heads[PROVIDER_BUCKETS];
+	struct index_stamp *stamps;
+	size_t nstamps;
+	size_t stamps_cap;
+	int dirty;
+	char *path;
+};
+
+/* Add a provider to the index. */
+static void provider_add(struct provider_index *idx, const char *provide,
+			 const char *version, const char *pkgname,
+			 const char *source, uint32_t votes, double popularity)
+{
+	struct provider *rp, *p;
+	size_t h;
+
+	if (idx->count == idx->cap) {
+		idx->cap = idx->cap == 0 ? (size_t)1024 : idx->cap * 2;
+		rp = realloc(idx->prov, idx->cap * sizeof(struct provider));
+		if (rp == NULL)
+			err(EXIT_FAILURE, "realloc()");
+		idx->prov = rp;
+	}
+
+	h = (size_t)fnv1a_hash(provide) & (PROVIDER_BUCKETS - 1);
+	p = &idx->prov[idx->count];
+	p->provide = xstrdup(provide);
+	p->version = xstrdup(version);
+	p->pkgname = xstrdup(pkgname);
+	p->source = xstrdup(source);
+	p->votes = votes;
+	p->popularity = popularity;
+	p->dead = 0;
+	/* Chain indices are shifted by one, 0 ends the chain. */
+	p->next = idx->heads[h];
+	idx->heads[h] = ++idx->count;
+	idx->dirty = 1;
+}
+
+/* Remove providers of the source. If provide isn't NULL,
+   only the ones providing it. */
+static void provider_drop(struct provider_index *idx, const char *source,
+			  const char *provide)
+{
+	size_t i;
+
+	for (i = 0; i < idx->count; i++) {
+		if (idx->prov[i].dead || strcmp(idx->prov[i].source, source) != 0)
+			continue;
+		if (provide != NULL && strcmp(idx->prov[i].provide, provide) != 0)
+			continue;
+
+		idx->prov[i].dead = 1;
+		idx->dirty = 1;
+	}
+}
+
+/* Get the stamp of kind and key, or 0 if there's none. */
+static time_t index_stamp_get(const struct provider_index *idx, char kind,
+			      const char *key)
+{
+	size_t i;
+
+	for (i = 0; i < idx->nstamps; i++)
+		if (idx->stamps[i].kind == kind &&
+		    strcmp(idx->stamps[i].key, key) == 0)
+			return (idx->stamps[i].t);
+	return (0);
+}
+
+/* Set the stamp of kind and key. */
+static void index_stamp_set(struct provider_index *idx, char kind,
+			    const char *key, time_t t)
+{
+	struct index_stamp *rp;
+	size_t i;
+
+	idx->dirty = 1;
+	for (i = 0; i < idx->nstamps; i++) {
+		if (idx->stamps[i].kind == kind &&
+		    strcmp(idx->stamps[i].key, key) == 0) {
+			idx->stamps[i].t = t;
+			return;
+		}
+	}
+
+	if (idx->nstamps == idx->stamps_cap) {
+		idx->stamps_cap = idx->stamps_cap == 0 ? (size_t)16 :
+			idx->stamps_cap * 2;
+		rp = realloc(idx->stamps, idx->stamps_cap *
+			     sizeof(struct index_stamp));
+		if (rp == NULL)
+			err(EXIT_FAILURE, "realloc()");
+		idx->stamps = rp;
+	}
+
+	idx->stamps[idx->nstamps].kind = kind;
+	idx->stamps[idx->nstamps].key = xstrdup(key);
+	idx->stamps[idx->nstamps].t = t;
+	idx->nstamps++;
+}
+
+/* Load the provider index from the cache directory. It's a text
+   file, with one tab separated record per line: "Q name time"
+   and "P provide version pkgname source votes popularity".
+   Older indices also kept the sync databases, those records are
+   dropped, as the sync index has them. */
+static void load_provider_index(struct provider_index *idx)
+{
+	char *dir, *buf, *line, *sp, *f[7];
+	size_t sz, n;
+	int stale;
+
+	memset(idx, '\0', sizeof(struct provider_index));
+	stale = 0;
+	dir = cache_dir_path();
+	if (dir == NULL)
+		return;
+
+	sz = strlen(dir) + sizeof("/"PROVIDER_INDEX_NAME);
+	idx->path = calloc(sz, sizeof(char));
+	if (idx->path == NULL)
+		err(EXIT_FAILURE, "calloc()");
+	snprintf(idx->path, sz, "%s/"PROVIDER_INDEX_NAME, dir);
+	free(dir);
+
+	buf = read_whole_file(idx->path);
+	if (buf == NULL)
+		return;
+
+	for (line = strtok_r(buf, "\n", &sp); line != NULL;
+	     line = strtok_r(NULL, "\n", &sp)) {
+		for (n = 0; n < ARRAY_SIZE(f) && line != NULL; n++)
+			f[n] = strsep(&line, "\t");
+
+		if (f[0][0] == 'P' && n == 7 && strcmp(f[4], "aur") == 0)
+			provider_add(idx, f[1], f[2], f[3], f[4],
+				     (uint32_t)safe_atoul(f[5]),
+				     strtod(f[6], (char **)NULL));
+		else if (f[0][0] == 'Q' && n == 3)
+			index_stamp_set(idx, f[0][0], f[1],
+					(time_t)strtoll(f[2], (char **)NULL, 10));
+		else
+			stale = 1;
+	}
+
+	idx->dirty = stale;
+	free(buf);
+}
+
+/* Write the provider index back, if it was changed. */
+static void save_provider_index(const struct provider_index *idx)
+{
+	struct curl_memory cm;
+	const struct provider *p;
+	size_t i;
+
+	if (idx->path == NULL || idx->dirty == 0)
+		return;
+
+	memset(&cm, '\0', sizeof(struct curl_memory));
+	for (i = 0; i < idx->nstamps; i++)
+		mem_append(&cm, "%c\t%s\t%lld\n", idx->stamps[i].kind,
+			   idx->stamps[i].key, (long long)idx->stamps[i].t);
+
+	for (i = 0; i < idx->count; i++) {
+		p = &idx->prov[i];
+		if (p->dead == 0)
+			mem_append(&cm, "P\t%s\t%s\t%s\t%s\t%u\t%.6f\n",
+				   p->provide, p->version, p->pkgname,
+				   p->source, p->votes, p->popularity);
+	}
+
+	write_whole_file(idx->path, cm.resp != NULL ? cm.resp : "");
+	free(cm.resp);
+}
+
+/* Free the provider index. */
+static void free_provider_index(struct provider_index *idx)
+{
+	size_t i;
+
+	for (i = 0; i < idx->count; i++) {
+		free(idx->prov[i].provide);
+		free(idx->prov[i].version);
+		free(idx->prov[i].pkgname);
+		free(idx->prov[i].source);
+	}
+
+	for (i = 0; i < idx->nstamps; i++)
+		free(idx->stamps[i].key);
+
+	free(idx->prov);
+	free(idx->stamps);
+	free(idx->path);
+}
+
+/* Query the AUR for packages providing name, unless it was
+   done in the last PROVIDER_TTL seconds. Search by provides
+   only returns the names, so their Provides (with versions)
+   are requested with a single info request. */
+static void refresh_aur_providers(struct provider_index *idx,
+				  const char *name)
+{
+	struct curl_memory cm;
+	char *esc, *json, *p, *q;
+	const char *pname, *pv;
+	JSON_Value *jsv;
+	JSON_Array *jarr, *jprov;
+	JSON_Object *jo;
+	size_t i, j, n;
+
+	if (time(NULL) - index_stamp_get(idx, 'Q', name) < PROVIDER_TTL)
+		return;
+
+	memset(&cm, '\0', sizeof(struct curl_memory));
+	esc = url_escape(name);
+	mem_append(&cm, "%s/%s?by=provides", AUR_SEARCH_PATH, esc);
+	free(esc);
+	json = budgeted_request(cm.resp);
+	jsv = json_parse_string(json);
+	jarr = json_object_get_array(json_object(jsv), "results");
+	n = json_array_get_count(jarr);
+	if (n > PROVIDER_MAX_INFO)
+		n = PROVIDER_MAX_INFO;
+
+	/* Build the info request. */
+	cm.nsz = 0;
+	mem_append(&cm, "%s", AUR_INFO_PATH);
+	for (i = 0; i < n; i++) {
+		pname = json_object_get_string(json_array_get_object(jarr, i),
+					       "Name");
+		if (pname == NULL)
+			continue;
+		esc = url_escape(pname);
+		/* The first one, which was added, starts the query. */
+		mem_append(&cm, "%sarg[]=%s", cm.nsz ==
+			   sizeof(AUR_INFO_PATH) - 1 ? "?" : "&", esc);
+		free(esc);
+	}
+	json_value_free(jsv);
+	free(json);
+
+	provider_drop(idx, "aur", name);
+	if (cm.nsz > sizeof(AUR_INFO_PATH) - 1) {
+		json = budgeted_request(cm.resp);
+		jsv = json_parse_string(json);
+		jarr = json_object_get_array(json_object(jsv), "results");
+
+		for (i = 0; i < json_array_get_count(jarr); i++) {
+			jo = json_array_get_object(jarr, i);
+			pname = json_object_get_string(jo, "Name");
+			pv = json_object_get_string(jo, "Version");
+			if (pname == NULL || pv == NULL)
+				continue;
+
+			/* A package always provides itself. */
+			if (strcmp(pname, name) == 0)
+				provider_add(idx, name, pv, pname, "aur",
+					     (uint32_t)json_object_get_number(jo, "NumVotes"),
+					     json_object_get_number(jo, "Popularity"));
+
+			jprov = json_object_get_array(jo, "Provides");
+			for (j = 0; j < json_array_get_count(jprov); j++) {
+				p = xstrdup(json_array_get_string(jprov, j));
+				q = strchr(p, '=');
+				if (q != NULL)
+					*q++ = '\0';
+				if (strcmp(p, name) == 0)
+					provider_add(idx, name, q != NULL ? q : "",
+						     pname, "aur",
+						     (uint32_t)json_object_get_number(jo, "NumVotes"),
+						     json_object_get_number(jo, "Popularity"));
+				free(p);
+			}
+		}
+
+		json_value_free(jsv);
+		free(json);
+	}
+
+	free(cm.resp);
+	index_stamp_set(idx, 'Q', name, time(NULL));
+}
+
+/* Compare two version segments, a port of rpmvercmp() from libalpm. */
+static int rpmvercmp(const char *a, const char *b)
+{
+	const char *one, *two, *p1, *p2;
+	size_t l1, l2;
+	int isnum, ret;
+
+	if (strcmp(a, b) == 0)
+		return (0);
+
+	one = p1 = a;
+	two = p2 = b;
+	while (*one != '\0' && *two != '\0') {
+		/* Skip separators. */
+		while (*one != '\0' && !isalnum((unsigned char)*one))
+			one++;
+		while (*two != '\0' && !isalnum((unsigned char)*two))
+			two++;
+		if (*one == '\0' || *two == '\0')
+			break;
+
+		/* Separators of different lengths. */
+		if (one - p1 != two - p2)
+			return (one - p1 < two - p2 ? -1 : 1);
+
+		p1 = one;
+		p2 = two;
+		if (isdigit((unsigned char)*p1)) {
+			while (isdigit((unsigned char)*p1))
+				p1++;
+			while (isdigit((unsigned char)*p2))
+				p2++;
+			isnum = 1;
+		} else {
+			while (isalpha((unsigned char)*p1))
+				p1++;
+			while (isalpha((unsigned char)*p2))
+				p2++;
+			isnum = 0;
+		}
+
+		/* Numeric segments are newer than alpha ones. */
+		if (p2 == two)
+			return (isnum ? 1 : -1);
+
+		if (isnum) {
+			while (*one == '0')
+				one++;
+			while (*two == '0')
+				two++;
+		}
+
+		l1 = (size_t)(p1 - one);
+		l2 = (size_t)(p2 - two);
+		if (isnum && l1 != l2)
+			return (l1 > l2 ? 1 : -1);
+
+		ret = strncmp(one, two, l1 < l2 ? l1 : l2);
+		if (ret == 0 && l1 != l2)
+			ret = l1 < l2 ? -1 : 1;
+		if (ret != 0)
+			return (ret < 0 ? -1 : 1);
+
+		one = p1;
+		two = p2;
+	}
+
+	if (*one == '\0' && *two == '\0')
+		return (0);
+
+	/* The one with an alpha segment left is older,
+	   otherwise the longer one is newer. */
+	if ((*one == '\0' && !isalpha((unsigned char)*two)) ||
+	    isalpha((unsigned char)*one))
+		return (-1);
+	return (1);
+}
+
+/* Compare "[epoch:]version[-release]" strings, like vercmp(8). */
+static int vercmp(const char *a, const char *b)
+{
+	char *ca, *cb, *va, *vb, *ra, *rb;
+	const char *ea, *eb;
+	int ret;
+
+	ca = xstrdup(a);
+	cb = xstrdup(b);
+
+	/* Split the epoch, which is 0 if missing. */
+	va = ca;
+	vb = cb;
+	ea = eb = "0";
+	for (ra = ca; isdigit((unsigned char)*ra); ra++)
+		;
+	if (*ra == ':') {
+		*ra = '\0';
+		ea = ca;
+		va = ra + 1;
+	}
+	for (rb = cb; isdigit((unsigned char)*rb); rb++)
+		;
+	if (*rb == ':') {
+		*rb = '\0';
+		eb = cb;
+		vb = rb + 1;
+	}
+
+	/* And the release. */
+	ra = strrchr(va, '-');
+	if (ra != NULL)
+		*ra++ = '\0';
+	rb = strrchr(vb, '-');
+	if (rb != NULL)
+		*rb++ = '\0';
+
+	ret = rpmvercmp(ea, eb);
+	if (ret == 0)
+		ret = rpmvercmp(va, vb);
+	/* Release is only compared if both have it. */
+	if (ret == 0 && ra != NULL && rb != NULL)
+		ret = rpmvercmp(ra, rb);
+
+	free(ca);
+	free(cb);
+	return (ret);
+}
+
+/* A provider of a dependency, from the provider index or the
+   sync index. Strings point into either of them. */
+struct candidate {
+	const char *provide;
+	const char *version;
+	const char *pkgname;
+	const char *source;
+	uint32_t votes;
+	double popularity;
+};
+
+/* Does the version satisfy "op version"? An unversioned
+   provide never satisfies a versioned dependency. */
+static int provider_satisfies(const char *pversion, const char *op,
+			      const char *version)
+{
+	int cmp;
+
+	if (*op == '\0')
+		return (1);
+	if (*pversion == '\0')
+		return (0);
+
+	cmp = vercmp(pversion, version);
+	if (strcmp(op, "=") == 0)
+		return (cmp == 0);
+	if (strcmp(op, ">=") == 0)
+		return (cmp >= 0);
+	if (strcmp(op, "<=") == 0)
+		return (cmp <= 0);
+	if (strcmp(op, ">") == 0)
+		return (cmp > 0);
+	return (cmp < 0);
+}
+
+/* Providers from the sync databases go first, as they don't
+   need to be built, then the ones with more votes and popularity. */
+static int provider_compare(const void *a, const void *b)
+{
+	const struct candidate *pa, *pb;
+	int aa, ab;
+
+	pa = (const struct candidate *)a;
+	pb = (const struct candidate *)b;
+	aa = strcmp(pa->source, "aur") == 0;
+	ab = strcmp(pb->source, "aur") == 0;
+
+	if (aa != ab)
+		return (aa - ab);
+	if (pa->votes != pb->votes)
+		return (pa->votes > pb->votes ? -1 : 1);
+	if (pa->popularity != pb->popularity)
+		return (pa->popularity > pb->popularity ? -1 : 1);
+	return (strcmp(pa->pkgname, pb->pkgname));
+}
+
+/* Append a candidate to the results. */
+static void add_candidate(struct candidate **res, size_t *count,
+			  size_t *cap, const struct candidate *c)
+{
+	struct candidate *rp;
+
+	if (*count == *cap) {
+		*cap = *cap == 0 ? (size_t)8 : *cap * 2;
+		rp = realloc(*res, *cap * sizeof(struct candidate));
+		if (rp == NULL)
+			err(EXIT_FAILURE, "realloc()");
+		*res = rp;
+	}
+	(*res)[(*count)++] = *c;
+}
+
+/* Find the providers of a dependency, like "sh", "java-runtime>=17"
+   or "libfoo.so=1-64", and return them ranked. Number of providers
+   is stored in count, and the caller frees the returned array. The
+   sync databases have the package name itself, as well as provides. */
+static struct candidate *find_providers(struct provider_index *idx,
+					const struct sync_index *si,
+					const char *dep, size_t *count)
+{
+	struct candidate *res, c;
+	const struct provider *p;
+	const struct sidx_entry *e;
+	char *name, *op, *ver;
+	char opbuf[3];
+	size_t i, cap, oplen;
+
+	name = xstrdup(dep);
+	op = name + strcspn(name, "<>=");
+	oplen = strspn(op, "<>=");
+	if (oplen > 2)
+		oplen = 2;
+	memcpy(opbuf, op, oplen);
+	opbuf[oplen] = '\0';
+	ver = op + strspn(op, "<>=");
+	*op = '\0';
+
+	refresh_aur_providers(idx, name);
+
+	res = NULL;
+	*count = cap = 0;
+	for (e = sync_index_find(si, name); e != NULL;
+	     e = sync_index_next(si, e)) {
+		c.provide = si->strings + e->key;
+		c.version = si->strings + e->version;
+		c.pkgname = si->strings + e->pkgname;
+		c.source = si->strings + e->repo;
+		c.votes = 0;
+		c.popularity = 0.0;
+		if (provider_satisfies(c.version, opbuf, ver))
+			add_candidate(&res, count, &cap, &c);
+	}
+
+	i = idx->heads[(size_t)fnv1a_hash(name) & (PROVIDER_BUCKETS - 1)];
+	for (; i != 0; i = p->next) {
+		p = &idx->prov[i - 1];
+		if (p->dead || strcmp(p->provide, name) != 0 ||
+		    provider_satisfies(p->version, opbuf, ver) == 0)
+			continue;
+
+		c.provide = p->provide;
+		c.version = p->version;
+		c.pkgname = p->pkgname;
+		c.source = p->source;
+		c.votes = p->votes;
+		c.popularity = p->popularity;
+		add_candidate(&res, count, &cap, &c);
+	}
+
+	if (*count > 1)
+		qsort(res, *count, sizeof(struct candidate), provider_compare);
+
+	free(name);
+	return (res);
+}
+
+/* Print the ranked providers of each dependency. */
+static MAIN_ONLY void print_providers(char **deps, size_t ndeps, int enable_colors)
+{
+	struct provider_index idx;
+	struct sync_index si;
+	struct candidate *res;
+	size_t i, j, n;
+
+	load_provider_index(&idx);
+	open_sync_index(&si);
+	for (i = 0; i < ndeps; i++) {
+		res = find_providers(&idx, &si, deps[i], &n);
+		if (enable_colors)
+			fprintf(stdout, COLOR_BLUE":: "COLOR_WHITE"%s"COLOR_END"\n",
+				deps[i]);
+		else
+			fprintf(stdout, ":: %s\n", deps[i]);
+
+		if (n == 0)
+			fputs(" no providers were found.\n", stdout);
+
+		for (j = 0; j < n; j++) {
+			if (enable_colors)
+				fprintf(stdout, COLOR_PURPLE"%zu "COLOR_BLUE"%s"
+					COLOR_END"/"COLOR_WHITE"%s"COLOR_END,
+					j + 1, res[j].source, res[j].pkgname);
+			else
+				fprintf(stdout, "%zu %s/%s", j + 1,
+					res[j].source, res[j].pkgname);
+
+			if (strcmp(res[j].source, "aur") == 0)
+				fprintf(stdout, " (+%u %.2lf%%)", res[j].votes,
+					res[j].popularity);
+			if (*res[j].version != '\0')
+				fprintf(stdout, " (%s=%s)", res[j].provide,
+					res[j].version);
+			fputc('\n', stdout);
+		}
+		free(res);
+	}
+
+	close_sync_index(&si);
+	save_provider_index(&idx);
+	free_provider_index(&idx);
+}
+
+/* Add the names of the files in dir (shared libraries, hopefully). */
+static void add_lib_dir(struct name_list *libs, const char *dir)
+{
+	DIR *dp;
+	struct dirent *de;
+
+	dp = opendir(dir);
+	if (dp == NULL)
+		return;
+
+	while ((de = readdir(dp)) != NULL)
+		if (strstr(de->d_name, ".so") != NULL)
+			name_list_add(libs, de->d_name);
+	closedir(dp);
+}
+
+/* Add the libraries of the directories, which ld.so.conf (and the
+   files it includes) lists. */
+static void add_ld_so_conf(struct name_list *libs, const char *conf,
+			   int depth)
+{
+	char *buf, *line, *sv, *p;
+	glob_t gl;
+	size_t i;
+
+	buf = read_whole_file(conf);
+	if (buf == NULL)
+		return;
+
+	for (line = strtok_r(buf, "\n", &sv); line != NULL;
+	     line = strtok_r(NULL, "\n", &sv)) {
+		p = strchr(line, '#');
+		if (p != NULL)
+			*p = '\0';
+		line += strspn(line, " \t");
+		if (strncmp(line, "include", (size_t)7) == 0 &&
+		    (line[7] == ' ' || line[7] == '\t')) {
+			p = line + 7 + strspn(line + 7, " \t");
+			p[strcspn(p, " \t")] = '\0';
+			if (depth > 4 || glob(p, 0, NULL, &gl) != 0)
+				continue;
+			for (i = 0; i < gl.gl_pathc; i++)
+				add_ld_so_conf(libs, gl.gl_pathv[i], depth + 1);
+			globfree(&gl);
+			continue;
+		}
+
+		line[strcspn(line, " \t")] = '\0';
+		if (*line == '/')
+			add_lib_dir(libs, line);
+	}
+
+	free(buf);
+}
+
+/* A foreign package, and the libraries it has itself. */
+struct rebuild_pkg {
+	char *name;
+	char *base;
+	struct name_list own;
+	int broken;
+};
+
+/* A file of a foreign package, and the sonames it needs, which
+   cannot be found (one per line). */
+struct rebuild_file {
+	char *path;
+	size_t pkg;
+	struct curl_memory missing;
+};
+
+/* Shared by the scanning threads. Only next is written. */
+struct rebuild_scan {
+	struct rebuild_pkg *pkgs;
+	struct rebuild_file *files;
+	size_t nfiles;
+	size_t next;
+	pthread_mutex_t lock;
+	struct name_list libs;
+};
+
+/* Is the ELF file in our byte order? */
+static int elf_native(const unsigned char *map)
+{
+	uint16_t one;
+
+	one = 1;
+	return (map[EI_DATA] == (*(unsigned char *)&one == 1
+				 ? ELFDATA2LSB : ELFDATA2MSB));
+}
+
+/* Read the i'th program header of a 32 or 64 bit ELF file, as a
+   64 bit one. Returns -1, if it's out of the file. */
+static int elf_phdr(const unsigned char *map, size_t size, size_t i,
+		    Elf64_Phdr *ph)
+{
+	Elf64_Ehdr eh64;
+	Elf32_Ehdr eh32;
+	Elf32_Phdr ph32;
+	uint64_t off;
+
+	if (map[EI_CLASS] == ELFCLASS64) {
+		memcpy(&eh64, map, sizeof(Elf64_Ehdr));
+		off = eh64.e_phoff + i * eh64.e_phentsize;
+		if (i >= eh64.e_phnum || eh64.e_phentsize < sizeof(Elf64_Phdr) ||
+		    off > size || size - off < sizeof(Elf64_Phdr))
+			return (-1);
+		memcpy(ph, map + off, sizeof(Elf64_Phdr));
+		return (0);
+	}
+
+	memcpy(&eh32, map, sizeof(Elf32_Ehdr));
+	off = (uint64_t)eh32.e_phoff + i * eh32.e_phentsize;
+	if (i >= eh32.e_phnum || eh32.e_phentsize < sizeof(Elf32_Phdr) ||
+	    off > size || size - off < sizeof(Elf32_Phdr))
+		return (-1);
+	memcpy(&ph32, map + off, sizeof(Elf32_Phdr));
+	ph->p_type = ph32.p_type;
+	ph->p_offset = ph32.p_offset;
+	ph->p_vaddr = ph32.p_vaddr;
+	ph->p_filesz = ph32.p_filesz;
+	return (0);
+}
+
+/* Read the i'th entry of the dynamic section at off. Returns -1,
+   if it's out of the file (or the section). */
+static int elf_dyn(const unsigned char *map, size_t size, const Elf64_Phdr *dyn,
+		   size_t i, Elf64_Dyn *d)
+{
+	Elf32_Dyn d32;
+	size_t esz;
+
+	esz = map[EI_CLASS] == ELFCLASS64 ? sizeof(Elf64_Dyn) : sizeof(Elf32_Dyn);
+	if ((i + 1) * esz > dyn->p_filesz || dyn->p_offset > size ||
+	    (i + 1) * esz > size - dyn->p_offset)
+		return (-1);
+
+	if (esz == sizeof(Elf64_Dyn)) {
+		memcpy(d, map + dyn->p_offset + i * esz, esz);
+	} else {
+		memcpy(&d32, map + dyn->p_offset + i * esz, esz);
+		d->d_tag = d32.d_tag;
+		d->d_un.d_val = d32.d_un.d_val;
+	}
+	return (0);
+}
+
+/* File offset of a virtual address, from the loaded segments. */
+static int elf_addr_offset(const unsigned char *map, size_t size,
+			   uint64_t addr, uint64_t *off)
+{
+	Elf64_Phdr ph;
+	size_t i;
+
+	for (i = 0; elf_phdr(map, size, i, &ph) == 0; i++) {
+		if (ph.p_type == PT_LOAD && addr >= ph.p_vaddr &&
+		    addr - ph.p_vaddr < ph.p_filesz) {
+			*off = ph.p_offset + (addr - ph.p_vaddr);
+			return (*off < size ? 0 : -1);
+		}
+	}
+
+	return (-1);
+}
+
+/* A string of the dynamic string table, or NULL. */
+static const char *elf_str(const unsigned char *map, size_t size,
+			   uint64_t strtab, uint64_t val)
+{
+	const char *s;
+
+	if (strtab >= size || val >= size - strtab)
+		return (NULL);
+	s = (const char *)map + strtab + val;
+	if (memchr(s, '\0', size - strtab - val) == NULL)
+		return (NULL);
+	return (s);
+}
+
+/* Whether soname is in one of the directories of the run path
+   (colon separated), where $ORIGIN is the directory of the file. */
+static int in_run_path(const char *rpath, const char *file,
+		       const char *soname)
+{
+	struct curl_memory path;
+	const char *p, *origin;
+	size_t len, olen;
+	int found;
+
+	origin = strrchr(file, '/');
+	olen = origin == NULL ? 0 : (size_t)(origin - file);
+
+	found = 0;
+	memset(&path, '\0', sizeof(struct curl_memory));
+	for (p = rpath; *p != '\0' && found == 0; p += len + (p[len] == ':')) {
+		len = strcspn(p, ":");
+		if (len == 0)
+			continue;
+
+		path.nsz = 0;
+		if (strncmp(p, "$ORIGIN", (size_t)7) == 0)
+			mem_append(&path, "%.*s%.*s/%s", (int)olen, file,
+				   (int)(len - 7), p + 7, soname);
+		else if (strncmp(p, "${ORIGIN}", (size_t)9) == 0)
+			mem_append(&path, "%.*s%.*s/%s", (int)olen, file,
+				   (int)(len - 9), p + 9, soname);
+		else
+			mem_append(&path, "%.*s/%s", (int)len, p, soname);
+		found = access(path.resp, F_OK) == 0;
+	}
+
+	free(path.resp);
+	return (found);
+}
+
+/* Map the file, and note the sonames it needs (DT_NEEDED), which
+   aren't in the system's library directories, the package itself,
+   or its run path. Anything which isn't a dynamic ELF file is
+   skipped. */
+static void scan_elf_file(const struct rebuild_scan *rs,
+			  struct rebuild_file *rf)
+{
+	unsigned char *map;
+	struct stat st;
+	Elf64_Phdr ph, dyn;
+	Elf64_Dyn d;
+	uint64_t strtab, rpath;
+	const char *soname, *rp;
+	size_t i, size;
+	int fd, has_dyn, has_rpath;
+
+	fd = open(rf->path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1)
+		return;
+	if (fstat(fd, &st) == -1 || S_ISREG(st.st_mode) == 0 ||
+	    (size_t)st.st_size < sizeof(Elf64_Ehdr)) {
+		close(fd);
+		return;
+	}
+
+	size = (size_t)st.st_size;
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, (off_t)0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return;
+
+	if (memcmp(map, ELFMAG, (size_t)SELFMAG) != 0 ||
+	    (map[EI_CLASS] != ELFCLASS64 && map[EI_CLASS] != ELFCLASS32) ||
+	    elf_native(map) == 0)
+		goto done;
+
+	has_dyn = 0;
+	for (i = 0; elf_phdr(map, size, i, &ph) == 0; i++) {
+		if (ph.p_type == PT_DYNAMIC) {
+			dyn = ph;
+			has_dyn = 1;
+			break;
+		}
+	}
+	if (has_dyn == 0)
+		goto done;
+
+	/* The string table first, entries may come before it. */
+	strtab = 0;
+	rpath = 0;
+	has_rpath = 0;
+	for (i = 0; elf_dyn(map, size, &dyn, i, &d) == 0 &&
+		     d.d_tag != DT_NULL; i++) {
+		if (d.d_tag == DT_STRTAB &&
+		    elf_addr_offset(map, size, d.d_un.d_ptr, &strtab) == -1)
+			goto done;
+		if (d.d_tag == DT_RUNPATH || d.d_tag == DT_RPATH) {
+			rpath = d.d_un.d_val;
+			has_rpath = 1;
+		}
+	}
+	if (strtab == 0)
+		goto done;
+
+	rp = has_rpath ? elf_str(map, size, strtab, rpath) : NULL;
+	for (i = 0; elf_dyn(map, size, &dyn, i, &d) == 0 &&
+		     d.d_tag != DT_NULL; i++) {
+		if (d.d_tag != DT_NEEDED)
+			continue;
+
+		soname = elf_str(map, size, strtab, d.d_un.d_val);
+		if (soname == NULL || strchr(soname, '/') != NULL)
+			continue;
+		if (name_list_has(&rs->libs, soname) ||
+		    name_list_has(&rs->pkgs[rf->pkg].own, soname) ||
+		    (rp != NULL && in_run_path(rp, rf->path, soname)))
+			continue;
+
+		mem_append(&rf->missing, "%s\n", soname);
+	}
+
+done:
+	munmap(map, size);
+}
+
+/* Take files from the list, until it's empty. */
+static void *rebuild_worker(void *arg)
+{
+	struct rebuild_scan *rs;
+	size_t i;
+
+	rs = (struct rebuild_scan *)arg;
+	for (;;) {
+		pthread_mutex_lock(&rs->lock);
+		i = rs->next++;
+		pthread_mutex_unlock(&rs->lock);
+		if (i >= rs->nfiles)
+			break;
+		scan_elf_file(rs, &rs->files[i]);
+	}
+
+	return (NULL);
+}
+
+/* Read the foreign packages (which none of the sync databases has)
+   of the local database, and the files of them. */
+static size_t read_foreign_pkgs(const struct sync_index *si,
+				struct rebuild_pkg **pkgs,
+				struct rebuild_file **files, size_t *nfiles)
+{
+	DIR *dp;
+	struct dirent *de;
+	struct rebuild_pkg *p;
+	char *path, *desc, *list, *name, *f, *sv, *b;
+	size_t n, cap, fcap, sz;
+	void *tmp;
+
+	*pkgs = NULL;
+	*files = NULL;
+	*nfiles = 0;
+	n = cap = fcap = 0;
+
+	dp = opendir(DEFAULT_LOCAL_DIR);
+	if (dp == NULL) {
+		warn("opendir(): %s", DEFAULT_LOCAL_DIR);
+		return (0);
+	}
+
+	while ((de = readdir(dp)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		sz = sizeof(DEFAULT_LOCAL_DIR"/") + strlen(de->d_name) +
+			sizeof("/files");
+		path = calloc(sz, sizeof(char));
+		if (path == NULL)
+			err(EXIT_FAILURE, "calloc()");
+
+		snprintf(path, sz, "%s/%s/desc", DEFAULT_LOCAL_DIR, de->d_name);
+		desc = read_whole_file(path);
+		name = desc == NULL ? NULL : db_field(desc, "%NAME%");
+		if (name == NULL || sync_index_pkg(si, name) != NULL) {
+			free(name);
+			free(desc);
+			free(path);
+			continue;
+		}
+
+		if (n == cap) {
+			cap = cap == 0 ? 32 : cap * 2;
+			tmp = realloc(*pkgs, cap * sizeof(struct rebuild_pkg));
+			if (tmp == NULL)
+				err(EXIT_FAILURE, "realloc()");
+			*pkgs = tmp;
+		}
+
+		p = &(*pkgs)[n];
+		memset(p, '\0', sizeof(struct rebuild_pkg));
+		p->name = name;
+		p->base = db_field(desc, "%BASE%");
+		if (p->base == NULL)
+			p->base = xstrdup(name);
+		free(desc);
+
+		snprintf(path, sz, "%s/%s/files", DEFAULT_LOCAL_DIR, de->d_name);
+		desc = read_whole_file(path);
+		list = desc == NULL ? NULL : db_field(desc, "%FILES%");
+		for (f = list == NULL ? NULL : strtok_r(list, "\n", &sv);
+		     f != NULL; f = strtok_r(NULL, "\n", &sv)) {
+			/* Directories and detached debug symbols. */
+			if (f[strlen(f) - 1] == '/' ||
+			    strncmp(f, "usr/lib/debug/", (size_t)14) == 0)
+				continue;
+
+			b = strrchr(f, '/');
+			b = b == NULL ? f : b + 1;
+			if (strstr(b, ".so") != NULL)
+				name_list_add(&p->own, b);
+
+			if (*nfiles == fcap) {
+				fcap = fcap == 0 ? 1024 : fcap * 2;
+				tmp = realloc(*files,
+					      fcap * sizeof(struct rebuild_file));
+				if (tmp == NULL)
+					err(EXIT_FAILURE, "realloc()");
+				*files = tmp;
+			}
+
+			memset(&(*files)[*nfiles], '\0', sizeof(struct rebuild_file));
+			sz = strlen(f) + 2;
+			(*files)[*nfiles].path = calloc(sz, sizeof(char));
+			if ((*files)[*nfiles].path == NULL)
+				err(EXIT_FAILURE, "calloc()");
+			snprintf((*files)[*nfiles].path, sz, "/%s", f);
+			(*files)[*nfiles].pkg = n;
+			(*nfiles)++;
+		}
+		name_list_sort(&p->own);
+
+		free(list);
+		free(desc);
+		free(path);
+		n++;
+	}
+
+	closedir(dp);
+	return (n);
+}
+
+/* Find the foreign (AUR, mostly) packages, which link against
+   libraries that aren't there anymore, like after a soname bump
+   of a repository package. Their files are mapped and their
+   DT_NEEDED entries read, by a thread per CPU. */
+static MAIN_ONLY void check_rebuilds(int enable_colors)
+{
+	static const char *const lib_dirs[] = {
+		"/usr/lib", "/lib", "/usr/lib64", "/lib64"
+	};
+	struct rebuild_scan rs;
+	struct rebuild_pkg *pkgs;
+	struct sync_index si;
+	struct curl_memory bases;
+	pthread_t *threads;
+	char *so, *sv;
+	size_t npkgs, i, j, nthreads, nbroken;
+	long ncpu;
+
+	/* Without them, every package would look foreign. */
+	if (open_sync_index(&si) == -1)
+		errx(EXIT_FAILURE, "no sync databases in '%s', "
+		     "run 'pacman -Sy' first.", DEFAULT_SYNC_DIR);
+	memset(&rs, '\0', sizeof(struct rebuild_scan));
+	npkgs = read_foreign_pkgs(&si, &pkgs, &rs.files, &rs.nfiles);
+	close_sync_index(&si);
+	rs.pkgs = pkgs;
+
+	for (i = 0; i < ARRAY_SIZE(lib_dirs); i++)
+		add_lib_dir(&rs.libs, lib_dirs[i]);
+	add_ld_so_conf(&rs.libs, DEFAULT_LD_SO_CONF, 0);
+	name_list_sort(&rs.libs);
+
+	if (enable_colors)
+		fprintf(stdout, COLOR_BLUE":: "COLOR_WHITE
+			"Checking %zu files of %zu foreign packages...\n"
+			COLOR_END, rs.nfiles, npkgs);
+	else
+		fprintf(stdout, ":: Checking %zu files of %zu foreign packages...\n",
+			rs.nfiles, npkgs);
+	fflush(stdout);
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = ncpu < 1 ? 1 : (size_t)ncpu;
+	if (nthreads > rs.nfiles)
+		nthreads = rs.nfiles;
+
+	pthread_mutex_init(&rs.lock, NULL);
+	threads = calloc(nthreads == 0 ? 1 : nthreads, sizeof(pthread_t));
+	if (threads == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	for (i = 0; i < nthreads; i++) {
+		errno = pthread_create(&threads[i], NULL, rebuild_worker, &rs);
+		if (errno != 0)
+			err(EXIT_FAILURE, "pthread_create()");
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&rs.lock);
+	free(threads);
+
+	/* Files are in the order of their packages. */
+	for (i = 0; i < rs.nfiles; i++) {
+		if (rs.files[i].missing.nsz == 0)
+			continue;
+
+		pkgs[rs.files[i].pkg].broken = 1;
+		if (enable_colors)
+			fprintf(stdout, COLOR_BLUE"%s"COLOR_END" "
+				COLOR_WHITE"%s"COLOR_END":",
+				pkgs[rs.files[i].pkg].name, rs.files[i].path);
+		else
+			fprintf(stdout, "%s %s:", pkgs[rs.files[i].pkg].name,
+				rs.files[i].path);
+
+		for (so = strtok_r(rs.files[i].missing.resp, "\n", &sv);
+		     so != NULL; so = strtok_r(NULL, "\n", &sv))
+			if (enable_colors)
+				fprintf(stdout, " "COLOR_BRED"%s"COLOR_END, so);
+			else
+				fprintf(stdout, " %s", so);
+		fputc('\n', stdout);
+	}
+
+	/* Package bases to rebuild, once each. */
+	memset(&bases, '\0', sizeof(struct curl_memory));
+	nbroken = 0;
+	for (i = 0; i < npkgs; i++) {
+		if (pkgs[i].broken == 0)
+			continue;
+		for (j = 0; j < i; j++)
+			if (pkgs[j].broken &&
+			    strcmp(pkgs[j].base, pkgs[i].base) == 0)
+				break;
+		if (j < i)
+			continue;
+		mem_append(&bases, "%s%s", nbroken == 0 ? "" : " ",
+			   pkgs[i].base);
+		nbroken++;
+	}
+
+	if (nbroken == 0)
+		fputs(" nothing needs a rebuild.\n", stdout);
+	else if (enable_colors)
+		fprintf(stdout, COLOR_BLUE":: "COLOR_WHITE
+			"%zu package base(s) need a rebuild:"COLOR_END
+			"\n%s\n", nbroken, bases.resp);
+	else
+		fprintf(stdout, ":: %zu package base(s) need a rebuild:\n%s\n",
+			nbroken, bases.resp);
+
+	free(bases.resp);
+	for (i = 0; i < rs.nfiles; i++) {
+		free(rs.files[i].path);
+		free(rs.files[i].missing.resp);
+	}
+	free(rs.files);
+	for (i = 0; i < npkgs; i++) {
+		free(pkgs[i].name);
+		free(pkgs[i].base);
+		name_list_free(&pkgs[i].own);
+	}
+	free(pkgs);
+	name_list_free(&rs.libs);
+}
+
+/* Copy the results of src, whose name or description has term
+   (ignoring the case, like the AUR does), to dst. */
+static void store_filter(const struct aur_store *src, const char *term,
+			 struct aur_store *dst)
+{
+	size_t i, n;
+	const char *desc;
+
+	memset(dst, '\0', sizeof(struct aur_store));
+	for (i = 0, n = 0; i < src->count; i++)
+		if (strcasestr(store_str(src, src->name[i]), term) != NULL ||
+		    strcasestr(store_str(src, src->description[i]), term) != NULL)
+			n++;
+
+	store_alloc(dst, n);
+	for (i = 0, n = 0; i < src->count; i++) {
+		desc = store_str(src, src->description[i]);
+		if (strcasestr(store_str(src, src->name[i]), term) == NULL &&
+		    strcasestr(desc, term) == NULL)
+			continue;
+
+		dst->name[n] = store_add_string(dst, store_str(src, src->name[i]));
+		dst->description[n] = store_add_string(dst, desc);
+		dst->version[n] = store_add_string(dst,
+						   store_str(src, src->version[i]));
+		dst->numvotes[n] = src->numvotes[i];
+		dst->popularity[n] = src->popularity[i];
+		dst->outdated[n] = src->outdated[i];
+		dst->last_modified[n] = src->last_modified[i];
+		dst->maintainer[n] = store_intern(dst,
+						  store_str(src, src->maintainer[i]));
+		dst->url_path[n] = store_add_string(dst,
+						    store_str(src, src->url_path[i]));
+		dst->url_base[n] = store_intern(dst,
+						store_str(src, src->url_base[i]));
+		n++;
+	}
+}
+
+/* Recent searches of the interactive mode, the least recently
+   used one is replaced. */
+struct live_entry {
+	char *term;
+	struct aur_store st;
+	uint64_t used;
+};
+
+/* State of the interactive mode. */
+struct live_search {
+	char query[128];
+	size_t qlen;
+	struct live_entry lru[LIVE_LRU_SIZE];
+	uint64_t tick;
+	const struct aur_store *shown;
+	const char *status;
+	char *inflight;
+	int inflight_id;
+	uint64_t deadline;
+	int accept;
+	int enable_colors;
+	char *cache_dir;
+};
+
+static struct termios live_saved;
+static int live_raw;
+
+/* Put the terminal back, as it was. */
+static void live_restore_terminal(void)
+{
+	if (live_raw && prefetch_child == 0) {
+		tcsetattr(STDIN_FILENO, TCSAFLUSH, &live_saved);
+		live_raw = 0;
+	}
+}
+
+/* Milliseconds of the monotonic clock. */
+static uint64_t live_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000);
 }
 
-/* Format the output and then print it. */
-static void format_print_package_info(struct aur_pkg_info aur_info,
-				      int enable_colors)
+/* The results of term, if they're in the LRU. */
+static struct live_entry *live_lookup(struct live_search *ls, const char *term)
 {
-	char *pfirst_sub, *plast_mod, *outdated;
+	size_t i;
 
-	pfirst_sub = pretty_time(aur_info.first_sub);
-	plast_mod = pretty_time(aur_info.last_mod);
-	if (aur_info.outdated > (time_t)0) {
-		outdated = pretty_time(aur_info.outdated);
-	} else {
-		outdated = strdup("No");
-		if (outdated == NULL)
-			err(EXIT_FAILURE, "strdup()");
+	for (i = 0; i < LIVE_LRU_SIZE; i++) {
+		if (ls->lru[i].term != NULL && strcmp(ls->lru[i].term, term) == 0) {
+			ls->lru[i].used = ++ls->tick;
+			return (&ls->lru[i]);
+		}
 	}
 
-	/* If we've colors enabled. */
-	if (enable_colors) {
-		fprintf(stdout,
-			COLOR_BLUE":: "COLOR_WHITE"Package Name:"COLOR_END" %s\n"
-			COLOR_BLUE":: "COLOR_WHITE"Description:"COLOR_END" %s\n"
-			COLOR_BLUE":: "COLOR_WHITE"URL:"COLOR_END" %s\n"
-			COLOR_BLUE":: "COLOR_WHITE"Version:"COLOR_END" %s\n"
-			COLOR_BLUE":: "COLOR_WHITE"Outdated:"COLOR_END" %s\n"
-			COLOR_BLUE":: "COLOR_WHITE"Votes:"COLOR_END" %u\n"
-			COLOR_BLUE":: "COLOR_WHITE"First Submitted:"COLOR_END" %s\n"
-			COLOR_BLUE":: "COLOR_WHITE"Last Modified:"COLOR_END" %s\n"
-			COLOR_BLUE":: "COLOR_WHITE"Popularity:"COLOR_END" %.2lf%%\n",
-			aur_info.name, aur_info.description, aur_info.url,
-			aur_info.version, outdated, aur_info.num_votes,
-			pfirst_sub, plast_mod, aur_info.popularity);
-
-	        fprintf(stdout,
-			COLOR_BLUE":: "COLOR_WHITE"Depends:"COLOR_END" %s\n",
-			aur_info.depends);
-		fprintf(stdout,
-			COLOR_BLUE":: "COLOR_WHITE"Licenses:"COLOR_END" %s\n",
-			aur_info.licenses);
-	        fprintf(stdout,
-			COLOR_BLUE":: "COLOR_WHITE"Keywords:"COLOR_END" %s\n",
-			aur_info.keywords);
-		fprintf(stdout,
-			COLOR_BLUE":: "COLOR_WHITE"Opt-Depends:"COLOR_END" %s\n",
-			aur_info.optdeps);
-	} else {
-		fprintf(stdout,
-			":: Package Name: %s\n"
-			":: Description: %s\n"
-			":: URL: %s\n"
-			":: Version: %s\n"
-			":: Outdated: %s\n"
-			":: Votes: %u\n"
-			":: First Submitted: %s\n"
-			":: Last Modified: %s\n"
-			":: Popularity: %.2lf%%\n",
-			aur_info.name, aur_info.description, aur_info.url,
-			aur_info.version, outdated, aur_info.num_votes,
-			pfirst_sub, plast_mod, aur_info.popularity);
-
-	        fprintf(stdout, ":: Depends: %s\n", aur_info.depends);
-	        fprintf(stdout, ":: Licenses: %s\n", aur_info.licenses);
-	        fprintf(stdout, ":: Keywords: %s\n", aur_info.keywords);
-	        fprintf(stdout, ":: Opt-Depends: %s\n", aur_info.optdeps);
+	return (NULL);
+}
+
+/* An entry for term, which replaces the least recently used one.
+   The shown results are never replaced. */
+static struct live_entry *live_insert(struct live_search *ls, const char *term)
+{
+	struct live_entry *e;
+	size_t i;
+
+	e = NULL;
+	for (i = 0; i < LIVE_LRU_SIZE; i++) {
+		if (&ls->lru[i].st == ls->shown)
+			continue;
+		if (e == NULL || ls->lru[i].used < e->used)
+			e = &ls->lru[i];
 	}
 
-	/* Unmap all mapped spaces. */
-	free(pfirst_sub);
-	free(plast_mod);
-	free(outdated);
-	free(aur_info.depends);
-        free(aur_info.licenses);
-	free(aur_info.keywords);
-	free(aur_info.optdeps);        
+	free(e->term);
+	free_search_results(&e->st);
+	e->term = xstrdup(term);
+	e->used = ++ls->tick;
+	return (e);
 }
 
-/* Set all values to aur_pkg_info structure, and then call
-   the format function to print it out. */
-static void print_package_info(const char *pkg, int enable_colors)
+/* Results of an earlier search, which has all of term's results.
+   Name and description are matched with LIKE '%term%', so a search
+   for a part of term (without spaces) has them all. The one with
+   the least results is taken. */
+static struct live_entry *live_superset(struct live_search *ls,
+					const char *term)
 {
-        char *fmt, *r, *json;
-	const char *vs;
-        JSON_Object *jso, *jao;
-	JSON_Array *jar;
-	size_t asz, bsz, csz, i;
-	struct aur_pkg_info aur_info;
+	struct live_entry *e;
+	size_t i;
 
-	/* Format the URL. */
-        fmt = format_info_package(pkg);
-	json = request_aur_info_endpoint(fmt);
-	jso = json_object(json_parse_string(json));
-	jar = json_object_get_array(jso, "results");
-	/* Get the first array from the results. */
-	jao = json_array_get_object(jar, 0);
+	if (strpbrk(term, " \t") != NULL)
+		return (NULL);
 
-	/* Check if results array has some objects. */
-	if (json_array_get_count(jar) == 0) {
-		free(fmt);
-		free(json);
-		fprintf(stderr,
-			"error: no package was found called '%s'.\n",
-			pkg);
-		exit(EXIT_FAILURE);
+	e = NULL;
+	for (i = 0; i < LIVE_LRU_SIZE; i++) {
+		if (ls->lru[i].term == NULL ||
+		    strpbrk(ls->lru[i].term, " \t") != NULL ||
+		    strcasestr(term, ls->lru[i].term) == NULL)
+			continue;
+		if (e == NULL || ls->lru[i].st.count < e->st.count)
+			e = &ls->lru[i];
 	}
 
-	/* Retrieve information from the JSON. */
-	aur_info.name = json_object_get_string(jao, "Name");
-        aur_info.description = json_object_get_string(jao, "Description");
-	aur_info.url = json_object_get_string(jao, "URL");
-	if (aur_info.url == NULL)
-		aur_info.url = "none";
-
-	aur_info.version = json_object_get_string(jao, "Version");
-	aur_info.outdated = (time_t)json_object_get_number(jao, "OutOfDate");
-        aur_info.num_votes = (uint32_t)json_object_get_number(jao, "NumVotes");
-	aur_info.first_sub = (time_t)json_object_get_number(jao, "FirstSubmitted");
-	aur_info.last_mod = (time_t)json_object_get_number(jao, "LastModified");
-	aur_info.popularity = json_object_get_number(jao, "Popularity");
-
-	/* List of depends. */
-	asz = json_array_get_count(json_object_get_array(jao, "Depends"));
-	aur_info.depends = calloc((size_t)5, sizeof(char));
-	if (aur_info.depends == NULL)
-	        err(EXIT_FAILURE, "calloc()");
+	return (e);
+}
 
-	/* Check if there are depends or not. */
-	if (asz >= 1) {
-		for (i = 0; i < asz; i++) {
-			vs = json_array_get_string(json_object_get_array(jao, "Depends"), i);
-			bsz = strlen(aur_info.depends);
-			csz = strlen(vs) + (size_t)4;
-			r = realloc(aur_info.depends, bsz + csz);
-			if (r == NULL)
-				err(EXIT_FAILURE, "realloc()");
+/* Number of characters in the UTF-8 string (of len bytes), which
+   are the bytes other than continuation bytes. */
+static size_t utf8_chars(const char *str, size_t len)
+{
+	size_t i, n;
 
-			aur_info.depends = r;
-			memcpy(aur_info.depends + bsz, vs, csz - 4);
-			memcpy(aur_info.depends + bsz + csz - 4, " ", 2);
-		}
-	} else {
-		memcpy(aur_info.depends, "none", (size_t)4);
+	for (i = n = 0; i < len; i++)
+		if (((unsigned char)str[i] & 0xc0) != 0x80)
+			n++;
+	return (n);
+}
+
+/* Length in bytes of the first (at most) max characters of the
+   UTF-8 string, so it's never cut inside a character. */
+static size_t utf8_prefix(const char *str, size_t max)
+{
+	size_t i, n;
+
+	for (i = n = 0; str[i] != '\0'; i++) {
+		if (((unsigned char)str[i] & 0xc0) != 0x80 && n++ == max)
+			break;
 	}
+	return (i);
+}
 
-	/* List of licenses. */
-	asz = json_array_get_count(json_object_get_array(jao, "License"));
-	aur_info.licenses = calloc((size_t)5, sizeof(char));
-	if (aur_info.licenses == NULL)
-		err(EXIT_FAILURE, "calloc()");
+/* Draw the prompt, and as many results as the terminal has rows. */
+static void live_render(const struct live_search *ls)
+{
+	struct winsize ws;
+	struct curl_memory out;
+	const struct aur_store *st;
+	const char *name, *version, *desc;
+	size_t rows, cols, i, n;
+
+	rows = 24;
+	cols = 80;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 2) {
+		rows = ws.ws_row;
+		cols = ws.ws_col;
+	}
 
-	/* Check if there are licenses or not. */
-	if (asz >= 1) {
-		for (i = 0; i < asz; i++) {
-			vs = json_array_get_string(json_object_get_array(jao, "License"), i);
-			bsz = strlen(aur_info.licenses);
-			csz = strlen(vs) + (size_t)4;
-			r = realloc(aur_info.licenses, bsz + csz);
-			if (r == NULL)
-				err(EXIT_FAILURE, "realloc()");
+	memset(&out, '\0', sizeof(struct curl_memory));
+	mem_append(&out, "\x1b[H\x1b[J");
+	st = ls->shown;
+	for (i = 0; st != NULL && i < st->count && i < rows - 2; i++) {
+		name = store_str(st, st->name[i]);
+		version = store_str(st, st->version[i]);
+		desc = store_str(st, st->description[i]);
+		if (ls->enable_colors)
+			mem_append(&out, "\n"COLOR_BLUE"aur"COLOR_END"/"
+				   COLOR_WHITE"%s"COLOR_END" "
+				   COLOR_BGREEN"%s"COLOR_END" (+%u) ",
+				   name, version, st->numvotes[i]);
+		else
+			mem_append(&out, "\naur/%s %s (+%u) ",
+				   name, version, st->numvotes[i]);
+
+		/* Descriptions are cut at the end of the row, on a
+		   character boundary. */
+		n = utf8_chars(name, strlen(name)) +
+			utf8_chars(version, strlen(version)) + 16;
+		if (desc != NULL && n < cols)
+			mem_put(&out, desc, utf8_prefix(desc, cols - n));
+	}
 
-			aur_info.licenses = r;
-			memcpy(aur_info.licenses + bsz, vs, csz - 4);
-			memcpy(aur_info.licenses + bsz + csz - 4, " ", 2);
-		}
-	} else {
-	        memcpy(aur_info.licenses, "none", (size_t)4);
+	/* The prompt goes first, and the cursor stays there. */
+	mem_append(&out, "\x1b[H");
+	if (ls->enable_colors)
+		mem_append(&out, COLOR_BLUE":: "COLOR_WHITE"Search:"COLOR_END
+			   " %s  "COLOR_LCYAN"%s"COLOR_END, ls->query,
+			   ls->status != NULL ? ls->status : "");
+	else
+		mem_append(&out, ":: Search: %s  %s", ls->query,
+			   ls->status != NULL ? ls->status : "");
+	/* The column is in characters, not bytes. */
+	mem_append(&out, "\x1b[1;%zuH", sizeof(":: Search: ") +
+		   utf8_chars(ls->query, ls->qlen));
+
+	fwrite(out.resp, (size_t)1, out.nsz, stdout);
+	fflush(stdout);
+	free(out.resp);
+}
+
+/* Forget the request, which is in flight. */
+static void live_cancel(struct live_search *ls)
+{
+	if (ls->inflight_id > 0)
+		aurpkg_cancel(aur, ls->inflight_id);
+	ls->inflight_id = 0;
+	free(ls->inflight);
+	ls->inflight = NULL;
+}
+
+/* Show the results of the query, if we have them (or a superset of
+   them). Otherwise they're fetched, once the typing stops. */
+static void live_update(struct live_search *ls)
+{
+	struct live_entry *e, *sup;
+	static struct aur_store empty;
+
+	ls->deadline = 0;
+	if (ls->qlen < LIVE_MIN_TERM) {
+		live_cancel(ls);
+		ls->shown = &empty;
+		ls->status = "(type at least 2 characters)";
+		return;
 	}
 
-	/* List of keywords. */
-	asz = json_array_get_count(json_object_get_array(jao, "Keywords"));
-	aur_info.keywords = calloc((size_t)5, sizeof(char));
-	if (aur_info.keywords == NULL)
-		err(EXIT_FAILURE, "calloc()");
+	e = live_lookup(ls, ls->query);
+	if (e == NULL && (sup = live_superset(ls, ls->query)) != NULL) {
+		/* Sup won't be replaced, it's the most recently used. */
+		sup->used = ++ls->tick;
+		ls->shown = &sup->st;
+		e = live_insert(ls, ls->query);
+		store_filter(&sup->st, ls->query, &e->st);
+	}
 
-	/* Check if there are keywords or not. */
-	if (asz >= 1) {
-		for (i = 0; i < asz; i++) {
-			vs = json_array_get_string(json_object_get_array(jao, "Keywords"), i);
-			bsz = strlen(aur_info.keywords);
-			csz = strlen(vs) + (size_t)4;
-			r = realloc(aur_info.keywords, bsz + csz);
-			if (r == NULL)
-				err(EXIT_FAILURE, "realloc()");
+	if (e != NULL) {
+		live_cancel(ls);
+		ls->shown = &e->st;
+		ls->status = e->st.count == 0 ? "(no results)" : "";
+		return;
+	}
 
-			aur_info.keywords = r;
-			memcpy(aur_info.keywords + bsz, vs, csz - 4);
-			memcpy(aur_info.keywords + bsz + csz - 4, " ", 2);
-		}
-	} else {
-	        memcpy(aur_info.keywords, "none", (size_t)4);
+	/* Keep the last results, until the new ones are here. */
+	if (ls->inflight != NULL && strcmp(ls->inflight, ls->query) == 0)
+		return;
+	ls->deadline = live_now_ms() + LIVE_DEBOUNCE_MS;
+	ls->status = "(searching...)";
+}
+
+/* Results of a search are here. */
+static void live_done(struct aurpkg_ctx *ctx, const struct aurpkg_result *res,
+		      void *udata)
+{
+	struct live_search *ls;
+	struct live_entry *e;
+	JSON_Value *jv;
+	const char *msg;
+
+	(void)ctx;
+	ls = (struct live_search *)udata;
+	ls->inflight_id = 0;
+	if (res->error != AURPKG_OK || res->http_code != 200) {
+		ls->status = "(cannot search the AUR)";
+		ls->accept = 0;
+		goto out;
 	}
 
-	/* List of optional depends. */
-	asz = json_array_get_count(json_object_get_array(jao, "OptDepends"));
-	aur_info.optdeps = calloc((size_t)5, sizeof(char));
-	if (aur_info.optdeps == NULL)
-	        err(EXIT_FAILURE, "calloc()");
+	jv = json_parse_string(res->body);
+	msg = json_object_get_string(json_object(jv), "error");
+	if (jv == NULL || msg != NULL) {
+		/* Like "Too many package results.", keep on typing. */
+		ls->status = "(too many results, or a bad response)";
+		ls->accept = 0;
+		json_value_free(jv);
+		goto out;
+	}
 
-	/* Check if there are optional depends or not. */
-	if (asz >= 1) {
-		for (i = 0; i < asz; i++) {
-			vs = json_array_get_string(json_object_get_array(jao, "OptDepends"), i);
-			bsz = strlen(aur_info.optdeps);
-			csz = strlen(vs) + (size_t)4;
-			r = realloc(aur_info.optdeps, bsz + csz);
-			if (r == NULL)
-				err(EXIT_FAILURE, "realloc()");
+	e = live_insert(ls, ls->inflight);
+	collect_search_results(json_object(jv), &e->st);
+	json_value_free(jv);
+	live_update(ls);
+
+out:
+	free(ls->inflight);
+	ls->inflight = NULL;
+}
+
+/* Start searching the query, and cancel the stale one. Each search
+   is paid from the request budget, searches are skipped if it's
+   low. */
+static void live_fetch(struct live_search *ls)
+{
+	char *term, *path;
+	unsigned int wait;
+
+	ls->deadline = 0;
+	live_cancel(ls);
+	if (ls->cache_dir != NULL &&
+	    ledger_take_token(ls->cache_dir, (double)AUR_RATE_RESERVE,
+			      &wait) == 0) {
+		ls->status = "(request budget is low)";
+		ls->accept = 0;
+		return;
+	}
+
+	term = url_escape(ls->query);
+	path = format_simple_url(term);
+	free(term);
+	ls->inflight = xstrdup(ls->query);
+	ls->inflight_id = aurpkg_request(aur_context(), path, live_done, ls);
+	free(path);
+	if (ls->inflight_id < 0) {
+		ls->inflight_id = 0;
+		ls->status = "(cannot search the AUR)";
+		free(ls->inflight);
+		ls->inflight = NULL;
+	}
+}
 
-			aur_info.optdeps = r;
-			memcpy(aur_info.optdeps + bsz, vs, csz - 4);
-			memcpy(aur_info.optdeps + bsz + csz - 4, " ", 2);
+/* Apply the keys, which were typed. Returns 1 to quit. */
+static int live_keys(struct live_search *ls, const unsigned char *buf,
+		     size_t n)
+{
+	char prev[sizeof(ls->query)];
+	size_t i, len;
+
+	memcpy(prev, ls->query, sizeof(prev));
+	for (i = 0; i < n; i++) {
+		switch (buf[i]) {
+		case 0x03:		/* ^C */
+		case 0x04:		/* ^D */
+			return (1);
+		case 0x1b:
+			/* Escape alone quits, sequences (arrows) are
+			   ignored, up to their final byte. */
+			if (i + 1 == n)
+				return (1);
+			if (buf[i + 1] == '[') {
+				for (i += 2; i < n; i++)
+					if (buf[i] >= 0x40 && buf[i] <= 0x7e)
+						break;
+			} else if (buf[i + 1] == 'O') {
+				i += 2;
+			}
+			break;
+		case '\r':
+		case '\n':
+			ls->accept = ls->qlen >= LIVE_MIN_TERM;
+			break;
+		case 0x7f:
+		case 0x08:
+			/* The whole character, with its UTF-8
+			   continuation bytes. */
+			while (ls->qlen > 0 && ((unsigned char)
+			       ls->query[--ls->qlen] & 0xc0) == 0x80)
+				;
+			break;
+		case 0x15:		/* ^U */
+			ls->qlen = 0;
+			break;
+		case 0x17:		/* ^W */
+			/* Only ASCII spaces end a word, so it never
+			   stops inside a UTF-8 sequence. */
+			while (ls->qlen > 0 && ls->query[ls->qlen - 1] == ' ')
+				ls->qlen--;
+			while (ls->qlen > 0 && ls->query[ls->qlen - 1] != ' ')
+				ls->qlen--;
+			break;
+		default:
+			if (buf[i] < 0x20)
+				break;
+			/* A character, which doesn't fit, is left out
+			   as a whole. */
+			len = buf[i] >= 0xf0 ? 4 : buf[i] >= 0xe0 ? 3 :
+				buf[i] >= 0xc0 ? 2 : 1;
+			if (ls->qlen + len < sizeof(ls->query)) {
+				ls->query[ls->qlen++] = (char)buf[i];
+			} else {
+				while (i + 1 < n && (buf[i + 1] & 0xc0) == 0x80)
+					i++;
+			}
+			break;
 		}
-	} else {
-		memcpy(aur_info.optdeps, "none", (size_t)4);
-        }
+		ls->query[ls->qlen] = '\0';
+	}
 
-	format_print_package_info(aur_info, enable_colors);
-	free(fmt);
-	free(json);
+	if (strcmp(prev, ls->query) != 0)
+		live_update(ls);
+	return (0);
+}
+
+/* Search as you type. Results are shown while typing, from recent
+   searches if they have them, or from the AUR, once there's a pause.
+   Enter takes the results to the usual selection. */
+static MAIN_ONLY void interactive_search(const struct arg_opts *opts)
+{
+	struct live_search ls;
+	struct termios raw;
+	struct aur_store st;
+	struct timeval tv;
+	fd_set rfds, wfds, efds;
+	unsigned char buf[64];
+	uint64_t now;
+	long timeout;
+	ssize_t n;
+	size_t i;
+	int maxfd, running, quit;
+
+	if (isatty(STDIN_FILENO) == 0 || isatty(STDOUT_FILENO) == 0)
+		errx(EXIT_FAILURE, "error: interactive search needs a terminal.");
+
+	memset(&ls, '\0', sizeof(struct live_search));
+	ls.enable_colors = opts->is_colors;
+	ls.cache_dir = cache_dir_path();
+
+	if (tcgetattr(STDIN_FILENO, &live_saved) == -1)
+		err(EXIT_FAILURE, "tcgetattr()");
+	raw = live_saved;
+	raw.c_lflag &= ~(tcflag_t)(ICANON | ECHO | ISIG | IEXTEN);
+	raw.c_iflag &= ~(tcflag_t)(IXON | ICRNL);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1)
+		err(EXIT_FAILURE, "tcsetattr()");
+	live_raw = 1;
+	atexit(live_restore_terminal);
+
+	live_update(&ls);
+	live_render(&ls);
+	quit = 0;
+	for (;;) {
+		/* Enter, once the results of the query are here. */
+		if (ls.accept && ls.deadline == 0 && ls.inflight == NULL)
+			break;
+		if (ls.accept && ls.deadline != 0)
+			live_fetch(&ls);
+
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		FD_ZERO(&efds);
+		maxfd = -1;
+		aurpkg_fdset(aur_context(), &rfds, &wfds, &efds, &maxfd);
+		FD_SET(STDIN_FILENO, &rfds);
+		if (maxfd < STDIN_FILENO)
+			maxfd = STDIN_FILENO;
+
+		/* Until the library, or the typing pause needs us. */
+		timeout = aurpkg_timeout(aur);
+		if (ls.deadline != 0) {
+			now = live_now_ms();
+			if (ls.deadline <= now)
+				timeout = 0;
+			else if (timeout < 0 || (uint64_t)timeout > ls.deadline - now)
+				timeout = (long)(ls.deadline - now);
+		}
+		if (timeout < 0)
+			timeout = 1000;
+		tv.tv_sec = timeout / 1000;
+		tv.tv_usec = (timeout % 1000) * 1000;
+
+		if (select(maxfd + 1, &rfds, &wfds, &efds, &tv) == -1 &&
+		    errno != EINTR)
+			err(EXIT_FAILURE, "select()");
+
+		if (FD_ISSET(STDIN_FILENO, &rfds)) {
+			n = read(STDIN_FILENO, buf, sizeof(buf));
+			if (n <= 0 || live_keys(&ls, buf, (size_t)n)) {
+				quit = 1;
+				break;
+			}
+		}
+
+		if (ls.deadline != 0 && ls.deadline <= live_now_ms())
+			live_fetch(&ls);
+		aurpkg_perform(aur, &running);
+		live_render(&ls);
+	}
+
+	live_cancel(&ls);
+	live_restore_terminal();
+	fputs("\x1b[H\x1b[J", stdout);
+	fflush(stdout);
+
+	/* A copy, as the LRU goes away. */
+	memset(&st, '\0', sizeof(struct aur_store));
+	if (quit == 0 && ls.shown != NULL)
+		store_filter(ls.shown, "", &st);
+
+	for (i = 0; i < LIVE_LRU_SIZE; i++) {
+		free(ls.lru[i].term);
+		free_search_results(&ls.lru[i].st);
+	}
+	free(ls.inflight);
+	free(ls.cache_dir);
+
+	if (quit)
+		return;
+	if (st.count == 0)
+		fputs("error: no package results were found.\n", stderr);
+	else
+		install_search_results(&st, opts);
+	free_search_results(&st);
 }
 
 /* Print usage. */
-static void print_usage(int status, int enable_colors)
+static MAIN_ONLY void print_usage(int status, int enable_colors)
 {
 	FILE *out;
 
@@ -959,49 +6659,92 @@ static void print_usage(int status, int enable_colors)
 		      UNDERLINE COLOR_WHITE"Options:\n"COLOR_END
 		      COLOR_WHITE"  -s, --search"COLOR_END
 		      "\tSearch for a package in the AUR repository\n"
+		      COLOR_WHITE"  -I, --interactive"COLOR_END
+		      "\tSearch as you type\n"
 		      COLOR_WHITE"  -i, --info"COLOR_END
 		      "\tRetrieve information about a package\n"
+		      COLOR_WHITE"  -P, --provides"COLOR_END
+		      "\tFind packages providing a dependency\n"
+		      COLOR_WHITE"  -R, --check-rebuilds"COLOR_END
+		      "\tFind AUR packages linking to missing libraries\n"
 		      COLOR_WHITE"  -g, --get"COLOR_END
 		      "\tDownload anything from a specified URL\n"
 		      COLOR_WHITE"  -h, --help"COLOR_END
 		      "\tDisplay this help message\n", out);
 		fputs(UNDERLINE COLOR_WHITE"\nOptional:\n"COLOR_END
 		      COLOR_WHITE"  -c, --colors"COLOR_END
-		      "\tEnable colored output\n", out);
+		      "\tEnable colored output\n"
+		      COLOR_WHITE"  -C, --ccache"COLOR_END
+		      "\tUse ccache/sccache for builds\n"
+		      COLOR_WHITE"  -b, --build-root"COLOR_END
+		      " DIR\tBuild packages in DIR\n"
+		      COLOR_WHITE"  -p, --prefetch"COLOR_END
+		      " N\tDownload the top N results while choosing\n"
+		      COLOR_WHITE"  -k, --keyserver"COLOR_END
+		      " URL\tFetch missing PGP keys from URL\n"
+		      COLOR_WHITE"  -U, --install-once"COLOR_END
+		      "\tBuild everything, then install at once\n"
+		      COLOR_WHITE"  -n, --plan"COLOR_END
+		      "\tShow what the selection needs, without building\n"
+		      COLOR_WHITE"  -r, --local-repo"COLOR_END
+		      " DB\tPublish built packages to a repository\n", out);
 	} else {
 		fputs("aurpkg - A small and lightweight AUR helper\n"
 		      "Usage: aurpkg [OPTIONS]..\n\n"
 		      "Options:\n"
 		      "  -s, --search\tSearch for a package in the AUR repository\n"
+		      "  -I, --interactive\tSearch as you type\n"
 		      "  -i, --info\tRetrieve information about a package\n"
+		      "  -P, --provides\tFind packages providing a dependency\n"
+		      "  -R, --check-rebuilds\tFind AUR packages linking to missing libraries\n"
 		      "  -g, --get\tDownload anything from a specified URL\n"
 		      "  -h, --help\tDisplay this help message\n", out);
 		fputs("\nOptional:\n"
-		     "  -c, --colors\tEnable colored output\n", out);
+		     "  -c, --colors\tEnable colored output\n"
+		     "  -C, --ccache\tUse ccache/sccache for builds\n"
+		     "  -b, --build-root DIR\tBuild packages in DIR\n"
+		     "  -p, --prefetch N\tDownload the top N results while choosing\n"
+		     "  -k, --keyserver URL\tFetch missing PGP keys from URL\n"
+		     "  -U, --install-once\tBuild everything, then install at once\n"
+		     "  -n, --plan\tShow what the selection needs, without building\n"
+		     "  -r, --local-repo DB\tPublish built packages to a repository\n", out);
 	}
 	/* TODO: add usage here. Cleanup, test arguments, add readme. */
 	exit(status);
 }
 
+#ifndef AURPKG_BENCH
 /* The main function. */
 int main(int argc, char **argv)
 {
-	char *json;
-	int i;
+	char *json, *cwd, *local_repo;
+	size_t sz;
+	int i, search_sc;
 	struct arg_opts opts = {0};
 	struct option lopts[] = {
-		{ "search",  required_argument, NULL, 's' },
-		{ "info",    required_argument, NULL, 'i' },
-		{ "colors",  no_argument,       NULL, 'c' },
-		{ "help",    no_argument,       NULL, 'h' },
-		{ NULL,      0,                 NULL,  0  },
+		{ "search",     required_argument, NULL, 's' },
+		{ "info",       required_argument, NULL, 'i' },
+		{ "colors",     no_argument,       NULL, 'c' },
+		{ "help",       no_argument,       NULL, 'h' },
+		{ "ccache",     no_argument,       NULL, 'C' },
+		{ "build-root", required_argument, NULL, 'b' },
+		{ "prefetch",   required_argument, NULL, 'p' },
+		{ "provides",   no_argument,       NULL, 'P' },
+		{ "keyserver",  required_argument, NULL, 'k' },
+		{ "install-once", no_argument,     NULL, 'U' },
+		{ "check-rebuilds", no_argument,   NULL, 'R' },
+		{ "local-repo", required_argument, NULL, 'r' },
+		{ "interactive", no_argument,      NULL, 'I' },
+		{ "plan",       no_argument,       NULL, 'n' },
+		{ NULL,         0,                 NULL,  0  },
 	};
 
 	if (argc < 2)
 		print_usage(EXIT_FAILURE, 0);
 
+	search_sc = 0;
         for (;;) {
-		opts.c = getopt_long(argc, argv, "s:i:ch", lopts, NULL);
+		opts.c = getopt_long(argc, argv, "s:i:chCb:p:Pk:URr:In", lopts, NULL);
 		if (opts.c == -1)
 			break;
 
@@ -1009,6 +6752,10 @@ int main(int argc, char **argv)
 		case 's':
 			/* Option: "-s'. */
 			opts.is_search = 1;
+			opts.search = optarg;
+			/* Was it "-sc"? */
+			search_sc = strcmp(optarg, "c") == 0 &&
+				optarg != argv[optind - 1];
 			break;
 		case 'i':
 			/* Option: "-i'. */
@@ -1022,27 +6769,84 @@ int main(int argc, char **argv)
 			/* Option: "-h'. */
 			opts.is_help = 1;
 			break;
+		case 'C':
+			/* Option: "-C'. */
+			opts.is_ccache = 1;
+			break;
+		case 'b':
+			/* Option: "-b'. */
+			opts.build_root = optarg;
+			break;
+		case 'p':
+			/* Option: "-p'. */
+			opts.prefetch = (size_t)safe_atoul(optarg);
+			break;
+		case 'P':
+			/* Option: "-P'. */
+			opts.is_provides = 1;
+			break;
+		case 'k':
+			/* Option: "-k'. */
+			opts.keyserver = optarg;
+			break;
+		case 'U':
+			/* Option: "-U'. */
+			opts.is_install_once = 1;
+			break;
+		case 'R':
+			/* Option: "-R'. */
+			opts.is_check_rebuilds = 1;
+			break;
+		case 'r':
+			/* Option: "-r'. */
+			opts.local_repo = optarg;
+			break;
+		case 'I':
+			/* Option: "-I'. */
+			opts.is_interactive = 1;
+			break;
+		case 'n':
+			/* Option: "-n'. */
+			opts.is_plan = 1;
+			break;
 		default:
 			/* Anything else as option, just ignore them. */
 			break;
 		}
 	}
 
+	/* Builds may be somewhere else (-b), so the local
+	   repository needs an absolute path. */
+	if (opts.local_repo != NULL && *opts.local_repo != '/') {
+		cwd = getcwd(NULL, 0);
+		if (cwd == NULL)
+			err(EXIT_FAILURE, "getcwd()");
+		sz = strlen(cwd) + strlen(opts.local_repo) + 2;
+		local_repo = calloc(sz, sizeof(char));
+		if (local_repo == NULL)
+			err(EXIT_FAILURE, "calloc()");
+		snprintf(local_repo, sz, "%s/%s", cwd, opts.local_repo);
+		opts.local_repo = local_repo;
+		free(cwd);
+	}
+
 	/* If option is "-s" or "--search". */
 	if (opts.is_search) {
 		/* If option is "-sc", enable color as well. */
-		if (argv[optind - 1][0] == '-' &&
-		    argv[optind - 1][1] == 's' &&
-		    argv[optind - 1][2] == 'c') {
+		if (search_sc && optind < argc) {
 			opts.is_colors = 1;
-			optind++;
+			opts.search = argv[optind++];
 		}
-	
-		json = search_for_pkg(argv[optind - 1]);
-		print_search_results(json, opts.is_colors);
-		free(json);
+
+		json = search_for_pkg(opts.search);
+		/* It frees the response. */
+		print_search_results(json, &opts);
         }
 
+	/* If option is "-I", "--interactive". */
+	if (opts.is_interactive)
+		interactive_search(&opts);
+
 	/* If option is "-i", "--info". */
 	if (opts.is_info) {
 		/* If option is "-ic", enable color as well. */
@@ -1068,7 +6872,302 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* If option is "-P", "--provides". */
+	if (opts.is_provides) {
+		if (optind >= argc)
+			print_usage(EXIT_FAILURE, opts.is_colors);
+		print_providers(argv + optind, (size_t)(argc - optind),
+				opts.is_colors);
+	}
+
+	/* If option is "-R", "--check-rebuilds". */
+	if (opts.is_check_rebuilds)
+		check_rebuilds(opts.is_colors);
+
 	/* If option is "-h", "--help". */
 	if (opts.is_help)
 	        print_usage(EXIT_SUCCESS, opts.is_colors);
 }
+#endif /* !AURPKG_BENCH */
+
+#ifdef AURPKG_BENCH
+/* CPU micro-benchmarks for the parse, sort and render paths.
+   No network and no standard input is used, instead synthetic
+   RPC responses are generated and fed to the same functions the
+   search and info options use. Each case runs in its own child
+   process, so the peak RSS is reported per case.
+
+   Build with: cc -O2 -pthread -DAURPKG_BENCH aurpkg.c libaurpkg.c \
+		-o aurpkg-bench -lcurl -lparson -lz */
+
+/* glibc's own allocator, which we wrap to count allocations. */
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void __libc_free(void *);
+
+static uint64_t bench_nalloc;
+
+void *malloc(size_t sz)
+{
+	bench_nalloc++;
+	return (__libc_malloc(sz));
+}
+
+void *calloc(size_t nmb, size_t sz)
+{
+	bench_nalloc++;
+	return (__libc_calloc(nmb, sz));
+}
+
+void *realloc(void *ptr, size_t sz)
+{
+	bench_nalloc++;
+	return (__libc_realloc(ptr, sz));
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+/* Number of results, that each response has. */
+static const size_t bench_sizes[] = { 10, 1000, 10000, 60000 };
+
+/* Number of elements in the arrays, used by the list-join case. */
+static const size_t bench_join_sizes[] = { 1, 10, 100, 1000 };
+
+/* Get the monotonic time in nanoseconds. */
+static uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec);
+}
+
+/* Generate a RPC response with nres results, every result has
+   narr elements in each of its arrays (Depends, License, etc.). */
+static char *bench_make_response(size_t nres, size_t narr)
+{
+	struct curl_memory cm;
+	size_t i, j;
+	uint32_t seed;
+	const char *keys[] = { "Depends", "License", "Keywords", "OptDepends" };
+	size_t k;
+
+	memset(&cm, '\0', sizeof(struct curl_memory));
+	seed = 2463534242u;
+	mem_append(&cm, "{\"resultcount\":%zu,\"results\":[", nres);
+	for (i = 0; i < nres; i++) {
+		/* xorshift32, so votes aren't already sorted. */
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+
+		mem_append(&cm, "%s{\"ID\":%zu,\"Name\":\"package-%zu\","
+			     "\"PackageBaseID\":%zu,\"PackageBase\":\"package-%zu\","
+			     "\"Version\":\"%u.%u.%u-1\",\"Description\":"
+			     "\"A synthetic package used for benchmarking "
+			     "number %zu\",\"URL\":\"https://example.org/%zu\","
+			     "\"NumVotes\":%u,\"Popularity\":%u.%02u,",
+			     i == 0 ? "" : ",", i, i, i / 2, i / 2,
+			     seed % 10, seed % 100, seed % 7, i, i,
+			     seed % 5000, seed % 30, seed % 100);
+		if (i % 7 == 0)
+			mem_append(&cm, "\"OutOfDate\":%u,",
+				     1500000000u + seed % 100000000u);
+		else
+			mem_append(&cm, "\"OutOfDate\":null,");
+
+		if (i % 11 == 0)
+			mem_append(&cm, "\"Maintainer\":null,");
+		else
+			mem_append(&cm, "\"Maintainer\":\"maintainer%u\",",
+				     seed % 64);
+
+		mem_append(&cm, "\"FirstSubmitted\":%u,\"LastModified\":%u,"
+			     "\"URLPath\":\"/cgit/aur.git/snapshot/"
+			     "package-%zu.tar.gz\"", 1400000000u + seed % 1000,
+			     1600000000u + seed % 1000, i / 2);
+
+		if (narr > 0) {
+			for (k = 0; k < ARRAY_SIZE(keys); k++) {
+				mem_append(&cm, ",\"%s\":[", keys[k]);
+				for (j = 0; j < narr; j++)
+					mem_append(&cm, "%s\"%s-element-%zu\"",
+						     j == 0 ? "" : ",", keys[k], j);
+				mem_append(&cm, "]");
+			}
+		}
+		mem_append(&cm, "}");
+	}
+	mem_append(&cm, "],\"type\":\"search\",\"version\":5}");
+
+	return (cm.resp);
+}
+
+/* Print a single result line. */
+static void bench_report(FILE *out, const char *name, size_t nrec,
+			 uint64_t ns, uint64_t nalloc, size_t iters)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	fprintf(out, "%-16s %8zu %14.1f %14.2f %14ld\n", name, nrec,
+		(double)ns / (double)(nrec * iters),
+		(double)nalloc / (double)(nrec * iters), ru.ru_maxrss);
+	fflush(out);
+}
+
+/* Benchmark the search path: parse, sort and collect, render. */
+static void bench_search(FILE *out, size_t nres)
+{
+	char *json;
+	JSON_Value *jsch;
+	struct aur_store st;
+	size_t i, iters;
+	uint64_t t, tparse, tcollect, trender;
+	uint64_t aparse, acollect, arender;
+
+	json = bench_make_response(nres, (size_t)0);
+	iters = nres >= (size_t)10000 ? (size_t)3 : (size_t)100000 / nres;
+	tparse = tcollect = trender = 0;
+	aparse = acollect = arender = 0;
+
+	for (i = 0; i < iters; i++) {
+		bench_nalloc = 0;
+		t = bench_now_ns();
+		jsch = json_parse_string(json);
+		tparse += bench_now_ns() - t;
+		aparse += bench_nalloc;
+
+		bench_nalloc = 0;
+		t = bench_now_ns();
+		collect_search_results(json_object(jsch), &st);
+		tcollect += bench_now_ns() - t;
+		acollect += bench_nalloc;
+		json_value_free(jsch);
+
+		bench_nalloc = 0;
+		t = bench_now_ns();
+		render_search_results(&st, NULL, i & 1);
+		trender += bench_now_ns() - t;
+		arender += bench_nalloc;
+
+		free_search_results(&st);
+	}
+
+	bench_report(out, "search/parse", nres, tparse, aparse, iters);
+	bench_report(out, "search/collect", nres, tcollect, acollect, iters);
+	bench_report(out, "search/render", nres, trender, arender, iters);
+	free(json);
+}
+
+/* Benchmark the info path, with a response of nres results. */
+static void bench_info(FILE *out, size_t nres)
+{
+	char *json;
+	JSON_Value *jsch;
+	struct aur_pkg_info aur_info;
+	size_t i, iters;
+	uint64_t t, tns, nalloc;
+
+	json = bench_make_response(nres, (size_t)4);
+	iters = nres >= (size_t)10000 ? (size_t)3 : (size_t)100000 / nres;
+	tns = nalloc = 0;
+
+	for (i = 0; i < iters; i++) {
+		bench_nalloc = 0;
+		t = bench_now_ns();
+		jsch = json_parse_string(json);
+		collect_package_info(json_array_get_object(
+			json_object_get_array(json_object(jsch), "results"), 0),
+				     &aur_info);
+		format_print_package_info(aur_info, i & 1);
+		json_value_free(jsch);
+		tns += bench_now_ns() - t;
+		nalloc += bench_nalloc;
+	}
+
+	bench_report(out, "info", nres, tns, nalloc, iters);
+	free(json);
+}
+
+/* Benchmark the list-join loops alone, where a record is
+   a single array element. */
+static void bench_join(FILE *out, size_t narr)
+{
+	char *json, *p;
+	JSON_Value *jsch;
+	JSON_Object *jao;
+	size_t i, iters;
+	uint64_t t, tns, nalloc;
+
+	json = bench_make_response((size_t)1, narr);
+	jsch = json_parse_string(json);
+	jao = json_array_get_object(json_object_get_array(
+		json_object(jsch), "results"), 0);
+	iters = (size_t)400000 / narr;
+	tns = nalloc = 0;
+
+	for (i = 0; i < iters; i++) {
+		bench_nalloc = 0;
+		t = bench_now_ns();
+		p = join_json_array(jao, "Depends");
+		tns += bench_now_ns() - t;
+		nalloc += bench_nalloc;
+		free(p);
+	}
+
+	bench_report(out, "join", narr, tns, nalloc, iters);
+	json_value_free(jsch);
+	free(json);
+}
+
+/* Run a single benchmark case in a child process. Output from
+   the render functions is sent to /dev/null. */
+static void bench_run(void (*fn)(FILE *, size_t), size_t n)
+{
+	pid_t pid;
+	FILE *out;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid == (pid_t)-1)
+		err(EXIT_FAILURE, "fork()");
+
+	if (pid == (pid_t)0) {
+		out = fdopen(dup(STDOUT_FILENO), "w");
+		if (out == NULL)
+			err(EXIT_FAILURE, "fdopen()");
+		if (freopen("/dev/null", "w", stdout) == NULL)
+			err(EXIT_FAILURE, "freopen()");
+
+		fn(out, n);
+		fclose(out);
+		_exit(EXIT_SUCCESS);
+	}
+
+	while (waitpid(pid, NULL, 0) < 0)
+		;
+}
+
+/* The benchmark's main function. */
+int main(void)
+{
+	size_t i;
+
+	fprintf(stdout, "%-16s %8s %14s %14s %14s\n", "case", "records",
+		"ns/record", "allocs/record", "peak RSS (KiB)");
+
+	for (i = 0; i < ARRAY_SIZE(bench_sizes); i++)
+		bench_run(bench_search, bench_sizes[i]);
+	for (i = 0; i < ARRAY_SIZE(bench_sizes); i++)
+		bench_run(bench_info, bench_sizes[i]);
+	for (i = 0; i < ARRAY_SIZE(bench_join_sizes); i++)
+		bench_run(bench_join, bench_join_sizes[i]);
+
+	return (EXIT_SUCCESS);
+}
+#endif /* AURPKG_BENCH */
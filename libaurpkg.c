@@ -0,0 +1,1172 @@
+/* Public Domain, feel free to use this, as you wish.
+   rilysh <horizon@quicknq.anonaddy.me> */
+
+#define _GNU_SOURCE
+
+/* Generic includes. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <curl/curl.h>
+#include <parson.h>
+
+#include "libaurpkg.h"
+
+/* General macros. */
+#define AUR_BASE_URL            "https://aur.archlinux.org"
+#define AUR_SEARCH_PATH         "/rpc/v5/search"
+#define AUR_INFO_PATH           "/rpc/v5/info"
+#define AUR_CGIT_PATH           "/cgit/aur.git/snapshot"
+
+/* Endpoint macros. They're probed again after an hour, and the
+   failed ones are avoided for 5 minutes. Throughput is only
+   measured with responses of 16 KiB or more. */
+#define MIRROR_PROBE_TTL        3600
+#define MIRROR_PROBE_TIMEOUT    5
+#define MIRROR_BACKOFF          300
+#define MIRROR_SPEED_MIN        16384
+
+/* Connections to the same host, the rest wait in a queue. */
+#define MAX_HOST_CONNECTIONS    8
+
+/* Number of elements in an array. */
+#define ARRAY_SIZE(x)           (sizeof(x) / sizeof(x[0]))
+
+/* A growable buffer, for the responses. */
+struct buffer {
+	char *p;
+	size_t sz;
+	size_t cap;
+};
+
+/* An AUR endpoint, the official one, a regional cache or a
+   caching proxy. Latency (ms) and throughput (bytes/s) are
+   averaged over the probes and requests to it. */
+struct endpoint {
+	char *url;
+	double rtt;
+	double speed;
+	unsigned int fails;
+	time_t probed;
+	time_t failed;
+};
+
+/* Kinds of operations. */
+enum request_kind {
+	REQ_RAW,
+	REQ_SEARCH,
+	REQ_INFO,
+	REQ_DOWNLOAD
+};
+
+/* An operation, which is waiting for the probes, or running on
+   one of the endpoints. tried has a flag for each endpoint. Direct
+   ones have an absolute URL, and don't use the endpoints. */
+struct request {
+	int id;
+	enum request_kind kind;
+	CURL *curl;
+	char *path;
+	char *file;
+	FILE *fp;
+	struct buffer body;
+	unsigned char *tried;
+	size_t ep;
+	int attempts;
+	int active;
+	int direct;
+	aurpkg_cb cb;
+	void *udata;
+	struct request *next;
+};
+
+/* The context. */
+struct aurpkg_ctx {
+	CURLM *multi;
+	CURLSH *share;
+	struct endpoint *ep;
+	size_t nep;
+	CURL **probes;
+	size_t nprobes;
+	int prepared;
+	int dirty;
+	char *state;
+	long max_rate;
+	long max_size;
+	int progress;
+	struct request *reqs;
+	int last_id;
+};
+
+/* Lists of a package, which aren't in the response. */
+static const char *const empty_list[] = { NULL };
+
+/* Append to the buffer, it's always kept null terminated.
+   Returns -1 if there's no memory. */
+static int buffer_append(struct buffer *b, const void *data, size_t len)
+{
+	char *rp;
+	size_t cap;
+
+	if (b->sz + len + 1 > b->cap) {
+		cap = b->cap == 0 ? (size_t)4096 : b->cap;
+		while (cap < b->sz + len + 1)
+			cap *= 2;
+		rp = realloc(b->p, cap);
+		if (rp == NULL)
+			return (-1);
+		b->p = rp;
+		b->cap = cap;
+	}
+
+	memcpy(b->p + b->sz, data, len);
+	b->sz += len;
+	b->p[b->sz] = '\0';
+	return (0);
+}
+
+/* Curl's write callback, used to store the response buffer. */
+static size_t write_cb(void *data, size_t sz, size_t nmb, void *usrp)
+{
+	if (buffer_append((struct buffer *)usrp, data, sz * nmb) == -1)
+		return (0);
+	return (sz * nmb);
+}
+
+/* Describe an error. */
+const char *aurpkg_strerror(enum aurpkg_error error)
+{
+	switch (error) {
+	case AURPKG_OK:
+		return ("success");
+	case AURPKG_ENOMEM:
+		return ("out of memory");
+	case AURPKG_EINVAL:
+		return ("invalid argument");
+	case AURPKG_ENET:
+		return ("transfer failed on every endpoint");
+	case AURPKG_EHTTP:
+		return ("unexpected HTTP status");
+	case AURPKG_EPARSE:
+		return ("malformed response");
+	case AURPKG_ERPC:
+		return ("the AUR returned an error");
+	case AURPKG_EIO:
+		return ("cannot write the file");
+	case AURPKG_ETOOBIG:
+		return ("the file is larger than the limit");
+	}
+
+	return ("unknown error");
+}
+
+/* Create a context. */
+struct aurpkg_ctx *aurpkg_new(void)
+{
+	struct aurpkg_ctx *ctx;
+
+	ctx = calloc((size_t)1, sizeof(struct aurpkg_ctx));
+	if (ctx == NULL)
+		return (NULL);
+
+	if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+		free(ctx);
+		return (NULL);
+	}
+
+	ctx->multi = curl_multi_init();
+	ctx->share = curl_share_init();
+	if (ctx->multi == NULL || ctx->share == NULL) {
+		if (ctx->multi != NULL)
+			curl_multi_cleanup(ctx->multi);
+		if (ctx->share != NULL)
+			curl_share_cleanup(ctx->share);
+		curl_global_cleanup();
+		free(ctx);
+		return (NULL);
+	}
+
+	/* Responses from the same host are multiplexed (with HTTP/2),
+	   and TLS sessions are resumed instead of a full handshake. */
+	curl_multi_setopt(ctx->multi, CURLMOPT_PIPELINING,
+			  (long)CURLPIPE_MULTIPLEX);
+	curl_multi_setopt(ctx->multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+			  (long)MAX_HOST_CONNECTIONS);
+	curl_share_setopt(ctx->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(ctx->share, CURLSHOPT_SHARE,
+			  CURL_LOCK_DATA_SSL_SESSION);
+
+	return (ctx);
+}
+
+/* Add an endpoint, without the trailing slashes. Endpoints
+   can't be added after the first operation. */
+enum aurpkg_error aurpkg_add_endpoint(struct aurpkg_ctx *ctx,
+				      const char *url)
+{
+	struct endpoint *rp;
+	size_t i, len;
+
+	if (ctx->prepared)
+		return (AURPKG_EINVAL);
+
+	len = strlen(url);
+	while (len > 0 && url[len - 1] == '/')
+		len--;
+	if (len == 0)
+		return (AURPKG_EINVAL);
+
+	for (i = 0; i < ctx->nep; i++)
+		if (strlen(ctx->ep[i].url) == len &&
+		    strncmp(ctx->ep[i].url, url, len) == 0)
+			return (AURPKG_OK);
+
+	rp = realloc(ctx->ep, (ctx->nep + 1) * sizeof(struct endpoint));
+	if (rp == NULL)
+		return (AURPKG_ENOMEM);
+	ctx->ep = rp;
+
+	memset(&ctx->ep[ctx->nep], '\0', sizeof(struct endpoint));
+	ctx->ep[ctx->nep].url = strndup(url, len);
+	if (ctx->ep[ctx->nep].url == NULL)
+		return (AURPKG_ENOMEM);
+	ctx->nep++;
+	return (AURPKG_OK);
+}
+
+/* Set the state file, it's read before the first operation. */
+enum aurpkg_error aurpkg_set_state_file(struct aurpkg_ctx *ctx,
+					const char *path)
+{
+	char *p;
+
+	if (ctx->prepared)
+		return (AURPKG_EINVAL);
+
+	p = strdup(path);
+	if (p == NULL)
+		return (AURPKG_ENOMEM);
+	free(ctx->state);
+	ctx->state = p;
+	return (AURPKG_OK);
+}
+
+/* Set the limits of the next operations. */
+void aurpkg_set_limits(struct aurpkg_ctx *ctx, long max_rate, long max_size)
+{
+	ctx->max_rate = max_rate;
+	ctx->max_size = max_size;
+}
+
+/* Show the progress meter for the next downloads. */
+void aurpkg_set_progress_meter(struct aurpkg_ctx *ctx, int enable)
+{
+	ctx->progress = enable;
+}
+
+/* Expected time (ms) to get a 64 KiB response from the endpoint.
+   Endpoints which failed recently go after the healthy ones. */
+static double endpoint_cost(const struct endpoint *e)
+{
+	double cost;
+
+	cost = e->rtt;
+	if (e->speed > 0.0)
+		cost += 65536.0 * 1000.0 / e->speed;
+	if (e->failed != 0 && time(NULL) - e->failed < MIRROR_BACKOFF)
+		cost += 1e9 * (double)e->fails;
+	return (cost);
+}
+
+/* Update the statistics of an endpoint after a transfer. */
+static void endpoint_record(struct aurpkg_ctx *ctx, struct endpoint *e,
+			    CURL *curl, int ok)
+{
+	double t;
+	curl_off_t sz, speed;
+
+	ctx->dirty = 1;
+	if (ok == 0) {
+		e->fails++;
+		e->failed = time(NULL);
+		return;
+	}
+
+	e->fails = 0;
+	e->failed = 0;
+	t = 0.0;
+	if (curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME, &t) == CURLE_OK)
+		e->rtt = e->rtt == 0.0 ? t * 1000.0 :
+			e->rtt * 0.7 + t * 1000.0 * 0.3;
+
+	sz = speed = 0;
+	curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &sz);
+	curl_easy_getinfo(curl, CURLINFO_SPEED_DOWNLOAD_T, &speed);
+	if (sz >= (curl_off_t)MIRROR_SPEED_MIN && speed > 0)
+		e->speed = e->speed == 0.0 ? (double)speed :
+			e->speed * 0.7 + (double)speed * 0.3;
+}
+
+/* Read the state file, which has one tab separated line for
+   each endpoint: "url rtt speed fails probed failed". */
+static void load_state(struct aurpkg_ctx *ctx)
+{
+	FILE *fp;
+	char *line, *p, *f[6];
+	size_t lsz, n, i;
+	ssize_t len;
+
+	fp = fopen(ctx->state, "r");
+	if (fp == NULL)
+		return;
+
+	line = NULL;
+	lsz = 0;
+	while ((len = getline(&line, &lsz, fp)) != -1) {
+		if (len > 0 && line[len - 1] == '\n')
+			line[len - 1] = '\0';
+
+		p = line;
+		for (n = 0; n < ARRAY_SIZE(f) && p != NULL; n++)
+			f[n] = strsep(&p, "\t");
+		if (n != ARRAY_SIZE(f))
+			continue;
+
+		for (i = 0; i < ctx->nep; i++) {
+			if (strcmp(ctx->ep[i].url, f[0]) != 0)
+				continue;
+			ctx->ep[i].rtt = strtod(f[1], (char **)NULL);
+			ctx->ep[i].speed = strtod(f[2], (char **)NULL);
+			ctx->ep[i].fails = (unsigned int)strtoul(f[3],
+								 (char **)NULL, 10);
+			ctx->ep[i].probed = (time_t)strtoll(f[4],
+							    (char **)NULL, 10);
+			ctx->ep[i].failed = (time_t)strtoll(f[5],
+							    (char **)NULL, 10);
+		}
+	}
+
+	free(line);
+	fclose(fp);
+}
+
+/* Write the state file back (to a temporary file, which is then
+   renamed), if anything was changed. */
+enum aurpkg_error aurpkg_save_state(struct aurpkg_ctx *ctx)
+{
+	FILE *fp;
+	char *tmp;
+	size_t i, sz;
+	int ret;
+
+	if (ctx->state == NULL || ctx->dirty == 0)
+		return (AURPKG_OK);
+
+	sz = strlen(ctx->state) + (size_t)32;
+	tmp = calloc(sz, sizeof(char));
+	if (tmp == NULL)
+		return (AURPKG_ENOMEM);
+
+	snprintf(tmp, sz, "%s.%ld", ctx->state, (long)getpid());
+	fp = fopen(tmp, "w");
+	if (fp == NULL) {
+		free(tmp);
+		return (AURPKG_EIO);
+	}
+
+	for (i = 0; i < ctx->nep; i++)
+		fprintf(fp, "%s\t%.3f\t%.0f\t%u\t%lld\t%lld\n", ctx->ep[i].url,
+			ctx->ep[i].rtt, ctx->ep[i].speed, ctx->ep[i].fails,
+			(long long)ctx->ep[i].probed,
+			(long long)ctx->ep[i].failed);
+
+	ret = fclose(fp) == 0 && rename(tmp, ctx->state) == 0;
+	if (ret == 0)
+		unlink(tmp);
+	else
+		ctx->dirty = 0;
+	free(tmp);
+	return (ret ? AURPKG_OK : AURPKG_EIO);
+}
+
+/* Probe the endpoints, which weren't probed in the last
+   MIRROR_PROBE_TTL seconds, with a HEAD request. They're all
+   probed at the same time, and operations wait for them. */
+static void start_probes(struct aurpkg_ctx *ctx)
+{
+	CURL *curl;
+	time_t now;
+	size_t i;
+
+	ctx->probes = calloc(ctx->nep, sizeof(CURL *));
+	if (ctx->probes == NULL)
+		return;
+
+	now = time(NULL);
+	for (i = 0; i < ctx->nep; i++) {
+		if (now - ctx->ep[i].probed < MIRROR_PROBE_TTL)
+			continue;
+
+		curl = curl_easy_init();
+		if (curl == NULL)
+			continue;
+		curl_easy_setopt(curl, CURLOPT_URL, ctx->ep[i].url);
+		curl_easy_setopt(curl, CURLOPT_NOBODY, (long)1);
+		curl_easy_setopt(curl, CURLOPT_TIMEOUT,
+				 (long)MIRROR_PROBE_TIMEOUT);
+		curl_easy_setopt(curl, CURLOPT_SHARE, ctx->share);
+		if (curl_multi_add_handle(ctx->multi, curl) != CURLM_OK) {
+			curl_easy_cleanup(curl);
+			continue;
+		}
+
+		ctx->probes[i] = curl;
+		ctx->ep[i].probed = now;
+		ctx->nprobes++;
+		ctx->dirty = 1;
+	}
+}
+
+/* Get ready for the first operation. If there's more than one
+   endpoint, the stale ones are probed. */
+static enum aurpkg_error prepare(struct aurpkg_ctx *ctx)
+{
+	enum aurpkg_error e;
+
+	if (ctx->prepared)
+		return (AURPKG_OK);
+
+	if (ctx->nep == 0) {
+		e = aurpkg_add_endpoint(ctx, AUR_BASE_URL);
+		if (e != AURPKG_OK)
+			return (e);
+	}
+
+	ctx->prepared = 1;
+	if (ctx->state != NULL)
+		load_state(ctx);
+
+	/* With a single endpoint, there's nothing to choose. */
+	if (ctx->nep > 1)
+		start_probes(ctx);
+	return (AURPKG_OK);
+}
+
+/* Is the handle one of the probes? If so, finish it. */
+static int finish_probe(struct aurpkg_ctx *ctx, CURL *curl, CURLcode ret)
+{
+	size_t i;
+	long code;
+
+	for (i = 0; ctx->probes != NULL && i < ctx->nep; i++)
+		if (ctx->probes[i] == curl)
+			break;
+	if (ctx->probes == NULL || i == ctx->nep)
+		return (0);
+
+	code = 0;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+	endpoint_record(ctx, &ctx->ep[i], curl,
+			ret == CURLE_OK && code > 0 && code < 500);
+
+	curl_multi_remove_handle(ctx->multi, curl);
+	curl_easy_cleanup(curl);
+	ctx->probes[i] = NULL;
+	ctx->nprobes--;
+	return (1);
+}
+
+/* Free an operation, it must be already unlinked. */
+static void free_request(struct aurpkg_ctx *ctx, struct request *req)
+{
+	if (req->active)
+		curl_multi_remove_handle(ctx->multi, req->curl);
+	if (req->curl != NULL)
+		curl_easy_cleanup(req->curl);
+	if (req->fp != NULL)
+		fclose(req->fp);
+
+	free(req->path);
+	free(req->file);
+	free(req->body.p);
+	free(req->tried);
+	free(req);
+}
+
+/* Remove an operation from the list. */
+static void unlink_request(struct aurpkg_ctx *ctx, struct request *req)
+{
+	struct request **pp;
+
+	for (pp = &ctx->reqs; *pp != NULL; pp = &(*pp)->next) {
+		if (*pp == req) {
+			*pp = req->next;
+			break;
+		}
+	}
+}
+
+/* Start (or restart) an operation, on the cheapest endpoint that
+   wasn't tried yet. Partial responses are discarded. Returns -1,
+   if every endpoint was tried. */
+static int launch(struct aurpkg_ctx *ctx, struct request *req)
+{
+	char *url;
+	size_t i, best, sz;
+	double cost, bcost;
+
+	if (req->direct) {
+		if (req->attempts > 0 ||
+		    curl_easy_setopt(req->curl, CURLOPT_URL, req->path) != CURLE_OK ||
+		    curl_multi_add_handle(ctx->multi, req->curl) != CURLM_OK)
+			return (-1);
+		req->attempts++;
+		req->active = 1;
+		return (0);
+	}
+
+	if (req->tried == NULL) {
+		req->tried = calloc(ctx->nep, sizeof(unsigned char));
+		if (req->tried == NULL)
+			return (-1);
+	}
+
+	best = ctx->nep;
+	bcost = 0.0;
+	for (i = 0; i < ctx->nep; i++) {
+		if (req->tried[i])
+			continue;
+		cost = endpoint_cost(&ctx->ep[i]);
+		if (best == ctx->nep || cost < bcost) {
+			best = i;
+			bcost = cost;
+		}
+	}
+	if (best == ctx->nep)
+		return (-1);
+
+	sz = strlen(ctx->ep[best].url) + strlen(req->path) + 1;
+	url = calloc(sz, sizeof(char));
+	if (url == NULL)
+		return (-1);
+	snprintf(url, sz, "%s%s", ctx->ep[best].url, req->path);
+	curl_easy_setopt(req->curl, CURLOPT_URL, url);
+	free(url);
+
+	if (req->attempts > 0) {
+		req->body.sz = 0;
+		if (req->body.p != NULL)
+			req->body.p[0] = '\0';
+		if (req->fp != NULL) {
+			fflush(req->fp);
+			rewind(req->fp);
+			if (ftruncate(fileno(req->fp), (off_t)0) == -1)
+				return (-1);
+		}
+	}
+
+	if (curl_multi_add_handle(ctx->multi, req->curl) != CURLM_OK)
+		return (-1);
+
+	req->tried[best] = 1;
+	req->ep = best;
+	req->attempts++;
+	req->active = 1;
+	return (0);
+}
+
+/* Collect the strings of a JSON array in the pool. */
+static const char *const *collect_list(JSON_Object *jo, const char *key,
+				       const char ***pool)
+{
+	JSON_Array *jarr;
+	const char **list, *s;
+	size_t i, n;
+
+	jarr = json_object_get_array(jo, key);
+	n = json_array_get_count(jarr);
+	if (n == 0)
+		return (empty_list);
+
+	list = *pool;
+	for (i = 0; i < n; i++) {
+		s = json_array_get_string(jarr, i);
+		if (s != NULL)
+			*(*pool)++ = s;
+	}
+	*(*pool)++ = NULL;
+	return (list);
+}
+
+/* Parse a RPC response, and call cb with its packages. Strings
+   point into the JSON tree, which is freed after the callback. */
+static enum aurpkg_error parse_and_call(struct aurpkg_ctx *ctx,
+					const char *json,
+					struct aurpkg_result *res,
+					aurpkg_cb cb, void *udata)
+{
+	static const char *const keys[] = {
+		"Depends", "MakeDepends", "OptDepends", "CheckDepends",
+		"Provides", "Conflicts", "License", "Keywords"
+	};
+	JSON_Value *jsv;
+	JSON_Object *jobj, *jo;
+	JSON_Array *jarr;
+	struct aurpkg_pkg *pkgs, *p;
+	const char **pool, **pp;
+	const char *type;
+	size_t i, j, n, total;
+
+	jsv = json_parse_string(json);
+	jobj = json_object(jsv);
+	if (jobj == NULL) {
+		json_value_free(jsv);
+		res->error = AURPKG_EPARSE;
+		cb(ctx, res, udata);
+		return (AURPKG_EPARSE);
+	}
+
+	type = json_object_get_string(jobj, "type");
+	if (type != NULL && strcmp(type, "error") == 0) {
+		res->error = AURPKG_ERPC;
+		res->message = json_object_get_string(jobj, "error");
+		cb(ctx, res, udata);
+		json_value_free(jsv);
+		return (AURPKG_ERPC);
+	}
+
+	jarr = json_object_get_array(jobj, "results");
+	n = json_array_get_count(jarr);
+
+	/* All lists of all packages go to a single pool. */
+	total = 0;
+	for (i = 0; i < n; i++) {
+		jo = json_array_get_object(jarr, i);
+		for (j = 0; j < ARRAY_SIZE(keys); j++)
+			total += json_array_get_count(
+				json_object_get_array(jo, keys[j])) + 1;
+	}
+
+	pkgs = calloc(n == 0 ? 1 : n, sizeof(struct aurpkg_pkg));
+	pool = calloc(total == 0 ? 1 : total, sizeof(const char *));
+	if (pkgs == NULL || pool == NULL) {
+		free(pkgs);
+		free(pool);
+		json_value_free(jsv);
+		res->error = AURPKG_ENOMEM;
+		cb(ctx, res, udata);
+		return (AURPKG_ENOMEM);
+	}
+
+	pp = pool;
+	for (i = 0; i < n; i++) {
+		jo = json_array_get_object(jarr, i);
+		p = &pkgs[i];
+		p->name = json_object_get_string(jo, "Name");
+		p->base = json_object_get_string(jo, "PackageBase");
+		p->version = json_object_get_string(jo, "Version");
+		p->description = json_object_get_string(jo, "Description");
+		p->url = json_object_get_string(jo, "URL");
+		p->url_path = json_object_get_string(jo, "URLPath");
+		p->maintainer = json_object_get_string(jo, "Maintainer");
+		p->votes = (uint32_t)json_object_get_number(jo, "NumVotes");
+		p->popularity = json_object_get_number(jo, "Popularity");
+		p->outdated = (time_t)json_object_get_number(jo, "OutOfDate");
+		p->first_submitted = (time_t)json_object_get_number(jo,
+			"FirstSubmitted");
+		p->last_modified = (time_t)json_object_get_number(jo,
+			"LastModified");
+		p->depends = collect_list(jo, keys[0], &pp);
+		p->makedepends = collect_list(jo, keys[1], &pp);
+		p->optdepends = collect_list(jo, keys[2], &pp);
+		p->checkdepends = collect_list(jo, keys[3], &pp);
+		p->provides = collect_list(jo, keys[4], &pp);
+		p->conflicts = collect_list(jo, keys[5], &pp);
+		p->licenses = collect_list(jo, keys[6], &pp);
+		p->keywords = collect_list(jo, keys[7], &pp);
+	}
+
+	res->error = AURPKG_OK;
+	res->pkgs = pkgs;
+	res->npkgs = n;
+	cb(ctx, res, udata);
+
+	free(pkgs);
+	free(pool);
+	json_value_free(jsv);
+	return (AURPKG_OK);
+}
+
+/* Parse a RPC response, which didn't come from a request. */
+enum aurpkg_error aurpkg_parse(struct aurpkg_ctx *ctx, const char *json,
+			       aurpkg_cb cb, void *udata)
+{
+	struct aurpkg_result res;
+
+	if (json == NULL || cb == NULL)
+		return (AURPKG_EINVAL);
+
+	memset(&res, '\0', sizeof(struct aurpkg_result));
+	res.body = json;
+	res.body_len = strlen(json);
+	return (parse_and_call(ctx, json, &res, cb, udata));
+}
+
+/* The operation is done, call its callback and free it. */
+static void complete_request(struct aurpkg_ctx *ctx, struct request *req,
+			     CURLcode ret, long code)
+{
+	struct aurpkg_result res;
+	int ok;
+
+	ok = ret == CURLE_OK && code < 500;
+	unlink_request(ctx, req);
+	memset(&res, '\0', sizeof(struct aurpkg_result));
+	res.id = req->id;
+	res.http_code = code;
+	res.body = req->body.p != NULL ? req->body.p : "";
+	res.body_len = req->body.sz;
+	res.file = req->file;
+
+	if (req->fp != NULL) {
+		if (fclose(req->fp) != 0 && ok)
+			ret = CURLE_WRITE_ERROR;
+		req->fp = NULL;
+	}
+
+	if (ret == CURLE_FILESIZE_EXCEEDED) {
+		res.error = AURPKG_ETOOBIG;
+	} else if (ret == CURLE_WRITE_ERROR) {
+		res.error = req->kind == REQ_DOWNLOAD ? AURPKG_EIO :
+			AURPKG_ENOMEM;
+	} else if (ret == CURLE_OUT_OF_MEMORY) {
+		res.error = AURPKG_ENOMEM;
+	} else if (ret == CURLE_HTTP_RETURNED_ERROR || code >= 500) {
+		res.error = AURPKG_EHTTP;
+	} else if (ret != CURLE_OK) {
+		res.error = AURPKG_ENET;
+		res.message = curl_easy_strerror(ret);
+	} else if ((req->kind == REQ_SEARCH || req->kind == REQ_INFO) &&
+		   code != 200) {
+		res.error = AURPKG_EHTTP;
+	}
+
+	if (res.error == AURPKG_OK &&
+	    (req->kind == REQ_SEARCH || req->kind == REQ_INFO))
+		parse_and_call(ctx, res.body, &res, req->cb, req->udata);
+	else
+		req->cb(ctx, &res, req->udata);
+
+	free_request(ctx, req);
+}
+
+/* Did the transfer fail because of us (our limits, memory or the
+   file), not the endpoint? Another one wouldn't do better. */
+static int local_failure(CURLcode ret)
+{
+	return (ret == CURLE_FILESIZE_EXCEEDED || ret == CURLE_WRITE_ERROR ||
+		ret == CURLE_OUT_OF_MEMORY || ret == CURLE_ABORTED_BY_CALLBACK);
+}
+
+/* A transfer of an operation is done. If it failed, because of the
+   endpoint, it's restarted on the next one. Otherwise the operation
+   is complete. Snapshots which are missing (with an HTTP error)
+   aren't the endpoint's fault, but another one may have it. Failures
+   of our own are neither recorded, nor tried again. */
+static void finish_request(struct aurpkg_ctx *ctx, struct request *req,
+			   CURLcode ret)
+{
+	long code;
+	int ok;
+
+	code = 0;
+	curl_easy_getinfo(req->curl, CURLINFO_RESPONSE_CODE, &code);
+	curl_multi_remove_handle(ctx->multi, req->curl);
+	req->active = 0;
+
+	if (local_failure(ret)) {
+		complete_request(ctx, req, ret, code);
+		return;
+	}
+
+	ok = ret == CURLE_OK && code < 500;
+	if (req->direct == 0 && (ret != CURLE_HTTP_RETURNED_ERROR || code >= 500))
+		endpoint_record(ctx, &ctx->ep[req->ep], req->curl, ok);
+	if (ok == 0 && launch(ctx, req) == 0)
+		return;
+
+	complete_request(ctx, req, ret, code);
+}
+
+/* Create an operation of kind. */
+static struct request *new_request(struct aurpkg_ctx *ctx,
+				   enum request_kind kind,
+				   aurpkg_cb cb, void *udata)
+{
+	struct request *req;
+
+	req = calloc((size_t)1, sizeof(struct request));
+	if (req == NULL)
+		return (NULL);
+
+	req->kind = kind;
+	req->cb = cb;
+	req->udata = udata;
+	req->curl = curl_easy_init();
+	if (req->curl == NULL) {
+		free(req);
+		return (NULL);
+	}
+
+	curl_easy_setopt(req->curl, CURLOPT_PRIVATE, (void *)req);
+	curl_easy_setopt(req->curl, CURLOPT_SHARE, ctx->share);
+	curl_easy_setopt(req->curl, CURLOPT_NOPROGRESS, (long)1);
+	curl_easy_setopt(req->curl, CURLOPT_FOLLOWLOCATION, (long)1);
+	curl_easy_setopt(req->curl, CURLOPT_MAXREDIRS, (long)50);
+	if (ctx->max_rate > 0)
+		curl_easy_setopt(req->curl, CURLOPT_MAX_RECV_SPEED_LARGE,
+				 (curl_off_t)ctx->max_rate);
+
+	if (kind != REQ_DOWNLOAD) {
+		curl_easy_setopt(req->curl, CURLOPT_WRITEFUNCTION, write_cb);
+		curl_easy_setopt(req->curl, CURLOPT_WRITEDATA,
+				 (void *)&req->body);
+	}
+
+	return (req);
+}
+
+/* Add the operation to the context, and start it, unless the
+   endpoints are being probed. Returns its id, or a negated error. */
+static int submit(struct aurpkg_ctx *ctx, struct request *req)
+{
+	enum aurpkg_error e;
+
+	e = prepare(ctx);
+	if (e != AURPKG_OK) {
+		free_request(ctx, req);
+		return (-(int)e);
+	}
+
+	if ((ctx->nprobes == 0 || req->direct) && launch(ctx, req) == -1) {
+		free_request(ctx, req);
+		return (-(int)AURPKG_ENET);
+	}
+
+	/* Ids are positive, and wrap around. */
+	ctx->last_id = ctx->last_id == INT_MAX ? 1 : ctx->last_id + 1;
+	req->id = ctx->last_id;
+	req->next = ctx->reqs;
+	ctx->reqs = req;
+	return (req->id);
+}
+
+/* Search the AUR. */
+int aurpkg_search(struct aurpkg_ctx *ctx, const char *by, const char *term,
+		  aurpkg_cb cb, void *udata)
+{
+	struct request *req;
+	char *eterm, *eby;
+	size_t sz;
+
+	if (term == NULL || *term == '\0' || cb == NULL)
+		return (-(int)AURPKG_EINVAL);
+
+	req = new_request(ctx, REQ_SEARCH, cb, udata);
+	if (req == NULL)
+		return (-(int)AURPKG_ENOMEM);
+
+	eterm = curl_easy_escape(req->curl, term, 0);
+	eby = curl_easy_escape(req->curl, by != NULL ? by : "name-desc", 0);
+	if (eterm == NULL || eby == NULL) {
+		curl_free(eterm);
+		curl_free(eby);
+		free_request(ctx, req);
+		return (-(int)AURPKG_ENOMEM);
+	}
+
+	sz = sizeof(AUR_SEARCH_PATH"/?by=") + strlen(eterm) + strlen(eby);
+	req->path = calloc(sz, sizeof(char));
+	if (req->path != NULL)
+		snprintf(req->path, sz, AUR_SEARCH_PATH"/%s?by=%s", eterm, eby);
+	curl_free(eterm);
+	curl_free(eby);
+
+	if (req->path == NULL) {
+		free_request(ctx, req);
+		return (-(int)AURPKG_ENOMEM);
+	}
+
+	return (submit(ctx, req));
+}
+
+/* Request information about one or more packages. */
+int aurpkg_info(struct aurpkg_ctx *ctx, const char *const *names, size_t n,
+		aurpkg_cb cb, void *udata)
+{
+	struct request *req;
+	struct buffer b;
+	char *esc;
+	size_t i;
+	int fail;
+
+	if (names == NULL || n == 0 || cb == NULL)
+		return (-(int)AURPKG_EINVAL);
+
+	req = new_request(ctx, REQ_INFO, cb, udata);
+	if (req == NULL)
+		return (-(int)AURPKG_ENOMEM);
+
+	memset(&b, '\0', sizeof(struct buffer));
+	fail = buffer_append(&b, AUR_INFO_PATH, sizeof(AUR_INFO_PATH) - 1);
+	for (i = 0; i < n && fail == 0; i++) {
+		esc = curl_easy_escape(req->curl, names[i], 0);
+		fail = esc == NULL ||
+			buffer_append(&b, i == 0 ? "?arg[]=" : "&arg[]=",
+				      (size_t)7) == -1 ||
+			buffer_append(&b, esc, strlen(esc)) == -1;
+		curl_free(esc);
+	}
+
+	if (fail) {
+		free(b.p);
+		free_request(ctx, req);
+		return (-(int)AURPKG_ENOMEM);
+	}
+
+	req->path = b.p;
+	return (submit(ctx, req));
+}
+
+/* Do a plain request. */
+int aurpkg_request(struct aurpkg_ctx *ctx, const char *path,
+		   aurpkg_cb cb, void *udata)
+{
+	struct request *req;
+
+	if (path == NULL || cb == NULL)
+		return (-(int)AURPKG_EINVAL);
+
+	req = new_request(ctx, REQ_RAW, cb, udata);
+	if (req == NULL)
+		return (-(int)AURPKG_ENOMEM);
+
+	/* Anything else than a path is fetched as is. */
+	if (*path != '/') {
+		if (strncmp(path, "http://", (size_t)7) != 0 &&
+		    strncmp(path, "https://", (size_t)8) != 0) {
+			free_request(ctx, req);
+			return (-(int)AURPKG_EINVAL);
+		}
+		req->direct = 1;
+	}
+
+	req->path = strdup(path);
+	if (req->path == NULL) {
+		free_request(ctx, req);
+		return (-(int)AURPKG_ENOMEM);
+	}
+
+	return (submit(ctx, req));
+}
+
+/* Download a snapshot to the file. */
+int aurpkg_download(struct aurpkg_ctx *ctx, const char *pkgbase,
+		    const char *file, aurpkg_cb cb, void *udata)
+{
+	struct request *req;
+	char *esc;
+	size_t sz;
+
+	if (pkgbase == NULL || *pkgbase == '\0' || file == NULL || cb == NULL)
+		return (-(int)AURPKG_EINVAL);
+
+	req = new_request(ctx, REQ_DOWNLOAD, cb, udata);
+	if (req == NULL)
+		return (-(int)AURPKG_ENOMEM);
+
+	esc = curl_easy_escape(req->curl, pkgbase, 0);
+	req->file = strdup(file);
+	if (esc == NULL || req->file == NULL) {
+		curl_free(esc);
+		free_request(ctx, req);
+		return (-(int)AURPKG_ENOMEM);
+	}
+
+	sz = sizeof(AUR_CGIT_PATH"/.tar.gz") + strlen(esc);
+	req->path = calloc(sz, sizeof(char));
+	if (req->path != NULL)
+		snprintf(req->path, sz, AUR_CGIT_PATH"/%s.tar.gz", esc);
+	curl_free(esc);
+	if (req->path == NULL) {
+		free_request(ctx, req);
+		return (-(int)AURPKG_ENOMEM);
+	}
+
+	req->fp = fopen(file, "wb");
+	if (req->fp == NULL) {
+		free_request(ctx, req);
+		return (-(int)AURPKG_EIO);
+	}
+
+	curl_easy_setopt(req->curl, CURLOPT_WRITEDATA, (void *)req->fp);
+	curl_easy_setopt(req->curl, CURLOPT_FAILONERROR, (long)1);
+	curl_easy_setopt(req->curl, CURLOPT_NOPROGRESS, (long)!ctx->progress);
+	if (ctx->max_size > 0)
+		curl_easy_setopt(req->curl, CURLOPT_MAXFILESIZE_LARGE,
+				 (curl_off_t)ctx->max_size);
+
+	return (submit(ctx, req));
+}
+
+/* Cancel an operation. */
+enum aurpkg_error aurpkg_cancel(struct aurpkg_ctx *ctx, int id)
+{
+	struct request *req;
+
+	for (req = ctx->reqs; req != NULL; req = req->next)
+		if (req->id == id)
+			break;
+	if (req == NULL)
+		return (AURPKG_EINVAL);
+
+	unlink_request(ctx, req);
+	free_request(ctx, req);
+	return (AURPKG_OK);
+}
+
+/* Get the descriptors to wait for. */
+enum aurpkg_error aurpkg_fdset(struct aurpkg_ctx *ctx, fd_set *rfds,
+			       fd_set *wfds, fd_set *efds, int *maxfd)
+{
+	if (curl_multi_fdset(ctx->multi, rfds, wfds, efds, maxfd) != CURLM_OK)
+		return (AURPKG_ENET);
+	return (AURPKG_OK);
+}
+
+/* Get the longest time to wait, before calling aurpkg_perform(). */
+long aurpkg_timeout(struct aurpkg_ctx *ctx)
+{
+	long t;
+
+	if (curl_multi_timeout(ctx->multi, &t) != CURLM_OK)
+		return (0);
+	return (t);
+}
+
+/* Perform the transfers, which are ready, and finish the ones which
+   are done. Once the probes are done, waiting operations start. */
+enum aurpkg_error aurpkg_perform(struct aurpkg_ctx *ctx, int *running)
+{
+	struct request *req, *next;
+	CURLMsg *msg;
+	CURL *curl;
+	CURLcode ret;
+	int still, left, n;
+
+	if (curl_multi_perform(ctx->multi, &still) != CURLM_OK)
+		return (AURPKG_ENET);
+
+	while ((msg = curl_multi_info_read(ctx->multi, &left)) != NULL) {
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+
+		/* Message is gone, once the handle is removed. */
+		curl = msg->easy_handle;
+		ret = msg->data.result;
+		if (finish_probe(ctx, curl, ret))
+			continue;
+
+		req = NULL;
+		curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&req);
+		if (req != NULL)
+			finish_request(ctx, req, ret);
+	}
+
+	if (ctx->nprobes == 0) {
+		for (req = ctx->reqs; req != NULL; req = next) {
+			next = req->next;
+			if (req->active || req->attempts > 0)
+				continue;
+
+			if (launch(ctx, req) == -1) {
+				/* Nowhere to run it. */
+				complete_request(ctx, req,
+						 CURLE_COULDNT_CONNECT, 0);
+				next = ctx->reqs;
+			}
+		}
+	}
+
+	n = 0;
+	for (req = ctx->reqs; req != NULL; req = req->next)
+		n++;
+	if (running != NULL)
+		*running = n;
+	return (AURPKG_OK);
+}
+
+/* Wait for something to happen, and perform. */
+enum aurpkg_error aurpkg_poll(struct aurpkg_ctx *ctx, int timeout_ms,
+			      int *running)
+{
+	if (ctx->reqs == NULL && ctx->nprobes == 0) {
+		if (running != NULL)
+			*running = 0;
+		return (AURPKG_OK);
+	}
+
+	if (curl_multi_poll(ctx->multi, NULL, 0, timeout_ms, NULL) != CURLM_OK)
+		return (AURPKG_ENET);
+	return (aurpkg_perform(ctx, running));
+}
+
+/* Perform until every operation is done. */
+enum aurpkg_error aurpkg_run(struct aurpkg_ctx *ctx)
+{
+	enum aurpkg_error e;
+	int running;
+
+	e = aurpkg_perform(ctx, &running);
+	while (e == AURPKG_OK && running > 0)
+		e = aurpkg_poll(ctx, 1000, &running);
+	return (e);
+}
+
+/* Free the context. */
+void aurpkg_free(struct aurpkg_ctx *ctx)
+{
+	struct request *req;
+	size_t i;
+
+	if (ctx == NULL)
+		return;
+
+	while ((req = ctx->reqs) != NULL) {
+		ctx->reqs = req->next;
+		free_request(ctx, req);
+	}
+
+	for (i = 0; ctx->probes != NULL && i < ctx->nep; i++) {
+		if (ctx->probes[i] == NULL)
+			continue;
+		curl_multi_remove_handle(ctx->multi, ctx->probes[i]);
+		curl_easy_cleanup(ctx->probes[i]);
+	}
+
+	aurpkg_save_state(ctx);
+	for (i = 0; i < ctx->nep; i++)
+		free(ctx->ep[i].url);
+
+	curl_multi_cleanup(ctx->multi);
+	curl_share_cleanup(ctx->share);
+	curl_global_cleanup();
+	free(ctx->probes);
+	free(ctx->ep);
+	free(ctx->state);
+	free(ctx);
+}
@@ -0,0 +1,170 @@
+/* Public Domain, feel free to use this, as you wish.
+   rilysh <horizon@quicknq.anonaddy.me> */
+
+/* libaurpkg - talk to the AUR from your own program.
+
+   Everything is done through a context, which keeps the endpoints
+   and a single set of connections (and TLS sessions), so many
+   requests don't pay for a new handshake each. Operations are
+   asynchronous: they're started with aurpkg_search(), aurpkg_info(),
+   aurpkg_request() or aurpkg_download(), and their callback is called
+   once they're done, from aurpkg_perform(). It can be driven from
+   your own event loop (aurpkg_fdset() and aurpkg_timeout()), or with
+   aurpkg_poll() and aurpkg_run().
+
+   Nothing is printed and nothing exits, errors are returned. A
+   context must only be used from a single thread at a time. */
+
+#ifndef LIBAURPKG_H
+#define LIBAURPKG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/select.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Errors. Functions which start an operation return its id (> 0),
+   or a negated error. Others return the error itself. */
+enum aurpkg_error {
+	AURPKG_OK = 0,
+	AURPKG_ENOMEM,
+	AURPKG_EINVAL,
+	AURPKG_ENET,
+	AURPKG_EHTTP,
+	AURPKG_EPARSE,
+	AURPKG_ERPC,
+	AURPKG_EIO,
+	AURPKG_ETOOBIG
+};
+
+struct aurpkg_ctx;
+
+/* A package, from a search or an info request. Maintainer is NULL
+   if the package is orphaned, and outdated is 0 if it isn't flagged.
+   Lists are NULL terminated, and only info requests fill them,
+   otherwise they're empty. */
+struct aurpkg_pkg {
+	const char *name;
+	const char *base;
+	const char *version;
+	const char *description;
+	const char *url;
+	const char *url_path;
+	const char *maintainer;
+	uint32_t votes;
+	double popularity;
+	time_t outdated;
+	time_t first_submitted;
+	time_t last_modified;
+	const char *const *depends;
+	const char *const *makedepends;
+	const char *const *optdepends;
+	const char *const *checkdepends;
+	const char *const *provides;
+	const char *const *conflicts;
+	const char *const *licenses;
+	const char *const *keywords;
+};
+
+/* Result of an operation. It (and everything it points to) is only
+   valid until the callback returns. message has the details of an
+   error (like the RPC's error), or is NULL. */
+struct aurpkg_result {
+	int id;
+	enum aurpkg_error error;
+	const char *message;
+	long http_code;
+	const char *body;
+	size_t body_len;
+	const struct aurpkg_pkg *pkgs;
+	size_t npkgs;
+	const char *file;
+};
+
+/* Called once an operation is done. */
+typedef void (*aurpkg_cb)(struct aurpkg_ctx *, const struct aurpkg_result *,
+			  void *);
+
+/* Create and free a context. Freeing it cancels all operations
+   (without calling their callbacks), and saves the endpoint state. */
+struct aurpkg_ctx *aurpkg_new(void);
+void aurpkg_free(struct aurpkg_ctx *ctx);
+
+/* Add an endpoint, like "https://aur.archlinux.org" or a caching proxy.
+   If there's none, the official one is used. With more than one, they
+   are probed and requests go to the fastest one, and to the next one
+   if it fails. */
+enum aurpkg_error aurpkg_add_endpoint(struct aurpkg_ctx *ctx,
+				      const char *url);
+
+/* Keep the measured latency and throughput of the endpoints in
+   a file, so they don't need to be probed on every run. */
+enum aurpkg_error aurpkg_set_state_file(struct aurpkg_ctx *ctx,
+					const char *path);
+enum aurpkg_error aurpkg_save_state(struct aurpkg_ctx *ctx);
+
+/* Limit the receive rate (bytes/s) of operations started after this,
+   and the size of downloads (bytes). 0 is unlimited. A download over
+   the limit fails with AURPKG_ETOOBIG, and isn't tried again on the
+   other endpoints. */
+void aurpkg_set_limits(struct aurpkg_ctx *ctx, long max_rate, long max_size);
+
+/* Show curl's progress meter (on the standard error) for downloads. */
+void aurpkg_set_progress_meter(struct aurpkg_ctx *ctx, int enable);
+
+/* Search by "name", "name-desc", "maintainer", "depends", "provides"
+   and so on. If by is NULL, it's "name-desc". */
+int aurpkg_search(struct aurpkg_ctx *ctx, const char *by, const char *term,
+		  aurpkg_cb cb, void *udata);
+
+/* Information about one or more packages, in a single request. */
+int aurpkg_info(struct aurpkg_ctx *ctx, const char *const *names, size_t n,
+		aurpkg_cb cb, void *udata);
+
+/* Plain GET of a path, like "/rpc/v5/info?arg[]=yay". The body is in
+   the result, whatever the HTTP status is. An absolute URL (http or
+   https) is fetched as is, without the endpoints, but it still uses
+   the context's connections. */
+int aurpkg_request(struct aurpkg_ctx *ctx, const char *path,
+		   aurpkg_cb cb, void *udata);
+
+/* Download the snapshot (a gzipped tarball) of a package base. */
+int aurpkg_download(struct aurpkg_ctx *ctx, const char *pkgbase,
+		    const char *file, aurpkg_cb cb, void *udata);
+
+/* Cancel an operation, its callback won't be called. */
+enum aurpkg_error aurpkg_cancel(struct aurpkg_ctx *ctx, int id);
+
+/* Parse a RPC response (which was cached, for example), and call
+   cb with its packages, before returning. */
+enum aurpkg_error aurpkg_parse(struct aurpkg_ctx *ctx, const char *json,
+			       aurpkg_cb cb, void *udata);
+
+/* Event loop integration. Wait for the descriptors in aurpkg_fdset()
+   (up to aurpkg_timeout() milliseconds, -1 is no timeout), then call
+   aurpkg_perform(), which never blocks. running is set to the number
+   of operations that aren't done yet. */
+enum aurpkg_error aurpkg_fdset(struct aurpkg_ctx *ctx, fd_set *rfds,
+			       fd_set *wfds, fd_set *efds, int *maxfd);
+long aurpkg_timeout(struct aurpkg_ctx *ctx);
+enum aurpkg_error aurpkg_perform(struct aurpkg_ctx *ctx, int *running);
+
+/* Wait up to timeout_ms for something to happen, then perform. */
+enum aurpkg_error aurpkg_poll(struct aurpkg_ctx *ctx, int timeout_ms,
+			      int *running);
+
+/* Perform until every operation is done. */
+enum aurpkg_error aurpkg_run(struct aurpkg_ctx *ctx);
+
+/* Describe an error. */
+const char *aurpkg_strerror(enum aurpkg_error error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBAURPKG_H */